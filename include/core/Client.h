@@ -1,13 +1,37 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct Client Client;
 
+// relay frame delivered by Client_receive, payload already opened in encrypted mode
+typedef void (*ClientFrameHandler)(void *context, uint8_t type, uint64_t sequence, const uint8_t *payload, size_t length);
+
 Client *Client_create(const char *server_ip, int port, int *error_flag);
 void Client_destroy(Client *client);
 
 void Client_connect(Client *client, int *error_flag);
 int Client_is_connected(const Client *client);
 
+// files are received into the directory, without one they are discarded
+void Client_set_download_directory(Client *client, const char *directory, int *error_flag);
+// receive sequenced broadcasts through the relay's multicast group when it has one,
+// losses are repaired over the TCP connection
+void Client_enable_multicast(Client *client);
+// offer compression in the handshake, the relay decides whether to use it
+void Client_enable_compression(Client *client);
+// starts streaming a regular file to every other client
+void Client_send_file(Client *client, const char *path, int *error_flag);
+// publishes the newest value of a key, clients that are behind only get the latest one
+void Client_send_update(Client *client, const char *key, const void *value, size_t value_length, int *error_flag);
+
+// frame-level access for tools that drive connections themselves (run_Replay):
+// the socket to poll, raw frames out, and a non-blocking receive step
+int Client_get_file_descriptor(const Client *client);
+void Client_send_frame(Client *client, uint8_t type, const void *payload, size_t length, int *error_flag);
+// error_flag is set once the connection is gone
+void Client_receive(Client *client, ClientFrameHandler handler, void *context, int *error_flag);
+
 void Client_run(Client *client, int *error_flag);
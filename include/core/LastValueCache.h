@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/Message.h"
+
+// newest message per key of keyed updates; keys are numbered from 1 in the order they
+// first appear and the number tags the messages so queues can conflate them
+typedef struct LastValueCache LastValueCache;
+
+LastValueCache *LastValueCache_create(size_t max_keys, int *error_flag);
+void LastValueCache_destroy(LastValueCache *cache);
+
+// retains the message as the newest value of key and sets message->key to the key's
+// number; returns -1 (message untouched) if the key is new and the cache is full
+int LastValueCache_store(LastValueCache *cache, const uint8_t *key, size_t key_length, Message *message);
+
+// number of keys, values are numbered 1 through this
+size_t LastValueCache_count(const LastValueCache *cache);
+Message *LastValueCache_get(const LastValueCache *cache, uint32_t key);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct Message Message;
+
+typedef void (*MessageReleaseCallback)(Message *message, void *context);
+
+// reference counted encoded frame, shared by the fan-out and the history
+struct Message {
+    size_t reference_count;
+    uint64_t sequence;
+    uint32_t key;          // keyed update (see LastValueCache), 0 for messages never conflated
+    size_t length;         // encoded frame bytes
+    size_t payload_length; // plaintext payload bytes
+    uint8_t *data;         // the first length - external_length frame bytes
+    const uint8_t *external; // rest of the frame in a publisher-owned buffer, NULL if all inline
+    size_t external_length;
+    MessageReleaseCallback release_callback; // runs when the last reference is dropped
+    void *release_context;
+    Message *compressed; // same frame with a compressed payload, NULL if not worth it
+};
+
+Message *Message_create(size_t capacity, int *error_flag);
+Message *Message_retain(Message *message);
+void Message_release(Message *message);
+
+// describes the frame bytes from offset on, returns the number of iovecs used (at most 2)
+int Message_get_iovec(const Message *message, size_t offset, struct iovec iov[2]);
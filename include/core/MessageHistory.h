@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/Message.h"
+
+// fixed size ring of the most recent broadcasts, indexed by sequence number
+typedef struct MessageHistory MessageHistory;
+
+// With acknowledgements tracked the ring also counts, per message, the holders that
+// have not acknowledged it yet. A holder stands for one subscriber and acknowledges
+// cumulatively, which touches every message once, so tracking costs O(1) per message
+// and holder. Messages every holder has acknowledged are released early, except for
+// the newest `retain`, which stay for plain resuming clients.
+
+MessageHistory *MessageHistory_create(size_t capacity, int *error_flag);
+void MessageHistory_destroy(MessageHistory *history);
+
+int MessageHistory_track_acks(MessageHistory *history, size_t retain);
+
+// retains the message; sequences must be appended in increasing order without gaps.
+// Returns 1 if the ring was full and the evicted message was still unacknowledged.
+int MessageHistory_append(MessageHistory *history, Message *message);
+
+// a new holder that already has every sequence up to and including `acked`
+void MessageHistory_hold(MessageHistory *history, uint64_t acked);
+// the holder that had acknowledged up to `acked` now has everything up to `sequence`
+void MessageHistory_acknowledge(MessageHistory *history, uint64_t acked, uint64_t sequence);
+// the holder is gone, what it did not acknowledge no longer waits for it
+void MessageHistory_release(MessageHistory *history, uint64_t acked);
+
+// returns NULL if the sequence was never appended or is already evicted
+Message *MessageHistory_get(const MessageHistory *history, uint64_t sequence);
+
+uint64_t MessageHistory_first_sequence(const MessageHistory *history);
+uint64_t MessageHistory_next_sequence(const MessageHistory *history);
+size_t MessageHistory_count(const MessageHistory *history);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "core/Message.h"
+
+// per-client queue of frames waiting for the socket to become writable.
+// Lanes are scheduled with deficit round robin: each round a lane may send its
+// quantum of bytes, and at every frame boundary lanes are tried in priority order.
+// A control frame therefore waits at most for the frame being written, while the
+// quanta bound the share any lane takes from the others under load.
+typedef enum {
+    LANE_CONTROL, // handshake, flow control, server announcements
+    LANE_MESSAGE,
+    LANE_STREAM,
+    LANE_COUNT
+} OutboundLane;
+
+typedef struct OutboundQueue OutboundQueue;
+
+OutboundQueue *OutboundQueue_create(int *error_flag);
+void OutboundQueue_destroy(OutboundQueue *queue);
+
+// retains the message, returns -1 if out of memory; a keyed message replaces a queued
+// message with the same key in place (returning 1) unless that one is being written
+int OutboundQueue_push(OutboundQueue *queue, OutboundLane lane, Message *message);
+
+// frame to write next and how many of its bytes are already written, NULL if empty;
+// a partially written frame is always returned until it is finished
+Message *OutboundQueue_peek(OutboundQueue *queue, size_t *offset);
+
+// marks bytes of the peeked frame as written, releases it once complete
+void OutboundQueue_advance(OutboundQueue *queue, size_t bytes);
+
+size_t OutboundQueue_bytes(const OutboundQueue *queue);
+int OutboundQueue_is_empty(const OutboundQueue *queue);
@@ -2,12 +2,132 @@
 
 #include <netinet/in.h>
 #include <pthread.h>
-#include <sys/select.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct ProcessingServer ProcessingServer;
 
+// overload protection levels, each sheds what the ones before it do and more
+typedef enum {
+    LOAD_NORMAL,
+    LOAD_ACCEPTS_PAUSED,       // new connections wait in the listen backlog
+    LOAD_PUBLISHERS_THROTTLED, // a client's input is read at most once per throttle interval
+    LOAD_SHEDDING              // clients far behind skip chat broadcasts, uploads get no new credit
+} ProcessingServerLoad;
+
+typedef struct {
+    uint64_t messages_broadcast;
+    uint64_t bytes_copied;          // written through the regular copying path
+    uint64_t bytes_zerocopy;        // MSG_ZEROCOPY sends completed without a copy
+    uint64_t bytes_zerocopy_copied; // MSG_ZEROCOPY sends the kernel copied anyway (e.g. loopback)
+    uint64_t zerocopy_in_flight;    // sends still waiting for their completion
+    uint64_t multicast_datagrams;
+    uint64_t nack_requests;
+    uint64_t messages_repaired;     // resent over TCP after a NACK
+    uint64_t messages_compressed;   // broadcasts with a compressed variant
+    uint64_t compression_bytes_in;  // their payload bytes before compression
+    uint64_t compression_bytes_out; // and after
+    uint64_t compression_cpu_ns;    // thread CPU time spent compressing, including attempts that did not pay off
+    uint64_t updates_published;
+    uint64_t updates_conflated;     // queued updates replaced by a newer value before being sent
+    uint64_t cached_keys;           // keys in the last-value cache
+    uint64_t acks_received;
+    uint64_t retained_messages;     // broadcasts kept for replay
+    uint64_t lingering_subscribers; // disconnected reliable subscribers still waited for
+    uint64_t unacked_lost;          // unacknowledged broadcasts evicted from a full ring
+    uint64_t load_level;            // a ProcessingServerLoad
+    uint64_t loop_lag_us;           // smoothed duration of a loop iteration, what a new event may wait
+    uint64_t loop_lag_max_us;
+    uint64_t load_transitions;
+    uint64_t reads_throttled;
+    uint64_t messages_shed;         // chat broadcasts skipped for clients far behind
+} ProcessingServerStats;
+
+// hooks for embedding the relay, all run on the thread calling ProcessingServer_poll_once;
+// connection ids are the ones used in capture traces
+typedef struct {
+    // handshake finished, the client now receives broadcasts
+    void (*on_connect)(void *context, uint32_t connection_id, const struct sockaddr_in *address);
+    // text a client sent, called after it has been relayed
+    void (*on_message)(void *context, uint32_t connection_id, const char *text, size_t length);
+    // only for clients that got an on_connect
+    void (*on_disconnect)(void *context, uint32_t connection_id);
+    void *context;
+} ProcessingServerCallbacks;
+
+// buffer handed to ProcessingServer_publish_external is no longer referenced
+typedef void (*ProcessingServerRelease)(void *context, const void *buffer);
+
 ProcessingServer *ProcessingServer_create(int port, int *error_flag);
 void ProcessingServer_destroy(ProcessingServer *server);
 
-void ProcessingServer_run(ProcessingServer *server, int *error_flag);
+// seals every relayed message with a per-run group key handed out during the handshake
+void ProcessingServer_enable_encryption(ProcessingServer *server, int *error_flag);
+
+// messages of at least threshold bytes are sent with MSG_ZEROCOPY, the buffer stays
+// referenced until the kernel reports completion; 0 (default) disables it
+void ProcessingServer_set_zerocopy_threshold(ProcessingServer *server, size_t threshold);
+
+// offers compression to clients that can decode it; texts of at least threshold bytes
+// are compressed once per codec and sent compressed to every client that accepted it
+void ProcessingServer_enable_compression(ProcessingServer *server, size_t threshold);
+
+// at-least-once delivery, to be enabled before clients connect: broadcasts are kept in a
+// ring of capacity messages until every subscriber acknowledged them, including ones that
+// disconnected less than a while ago, and are replayed when the subscriber resumes;
+// resuming from exactly its last acknowledgement ends the wait for the old connection
+void ProcessingServer_enable_reliable_delivery(ProcessingServer *server, size_t capacity, int *error_flag);
+
+// low-latency mode: pins the event loop to cpu (-1 keeps the current affinity), turns on
+// socket busy polling and keeps polling without blocking for spin_us after the last event
+void ProcessingServer_enable_busy_poll(ProcessingServer *server, int cpu, unsigned int spin_us, int *error_flag);
+
+// publishes sequenced broadcasts once to a multicast group (sent from interface_ip,
+// NULL for the routing default); subscribed clients repair losses with NACKs
+void ProcessingServer_enable_multicast(ProcessingServer *server, const char *group_ip, int port,
+                                       const char *interface_ip, int *error_flag);
+
+// admission control driven by event-loop lag: once the smoothed iteration time reaches
+// lag_threshold_us the relay stops accepting, at twice that it throttles publishers and
+// at four times it sheds fan-out to clients far behind; a level is left only after the
+// lag stayed below half its threshold for a while
+void ProcessingServer_enable_overload_protection(ProcessingServer *server, unsigned int lag_threshold_us,
+                                                 int *error_flag);
 
+// records connects, disconnects and every inbound client frame to a trace file
+// (see core/Trace.h) for replay with run_Replay
+void ProcessingServer_enable_capture(ProcessingServer *server, const char *path, int *error_flag);
+
+void ProcessingServer_get_stats(const ProcessingServer *server, ProcessingServerStats *stats);
+
+void ProcessingServer_set_callbacks(ProcessingServer *server, const ProcessingServerCallbacks *callbacks);
+
+// readable whenever ProcessingServer_poll_once has work; register it with the host event loop
+int ProcessingServer_get_file_descriptor(const ProcessingServer *server);
+
+// handles whatever is ready, waiting up to timeout_ms (0 never blocks, -1 waits for an event);
+// with multicast enabled it must be called at least once a second for the heartbeat;
+// returns the number of events handled
+int ProcessingServer_poll_once(ProcessingServer *server, int timeout_ms, int *error_flag);
+
+// broadcasts text to every client as if the server console had sent it, without a prefix
+void ProcessingServer_publish(ProcessingServer *server, const void *payload, size_t length, int *error_flag);
+
+// like ProcessingServer_publish but on the control lane, ahead of queued chat and stream data,
+// so clients with a deep backlog still see it promptly; may arrive before older messages
+void ProcessingServer_announce(ProcessingServer *server, const void *payload, size_t length, int *error_flag);
+
+// keyed state update: stored as the key's newest value, handed to clients connecting
+// later, and conflated for clients that are behind; fails if the key is new and 65536
+// keys are cached, or if key and value exceed one frame (255-byte key, ~64 KiB in all)
+void ProcessingServer_publish_update(ProcessingServer *server, const void *key, size_t key_length, const void *value,
+                                     size_t value_length, int *error_flag);
+
+// like ProcessingServer_publish but sends straight from the caller's buffer, which must stay
+// unchanged until release runs: after every client was sent it and it left the resume history.
+// In encrypted mode the payload is sealed into a copy and release runs before returning.
+void ProcessingServer_publish_external(ProcessingServer *server, const void *buffer, size_t length,
+                                       ProcessingServerRelease release, void *context, int *error_flag);
+
+// interactive loop owning stdin and the terminal, built on ProcessingServer_poll_once
+void ProcessingServer_run(ProcessingServer *server, int *error_flag);
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "utils/crypto.h"
+
+/*
+ * Every message on the wire is a frame: a 16 byte header followed by the payload.
+ *
+ *   type (1) | flags (1) | reserved (2) | payload length (4) | sequence (8)
+ *
+ * Integers are big endian. The client opens with HELLO, the server answers with
+ * WELCOME and replays what the client missed, after that both sides exchange TEXT
+ * frames. Broadcast frames carry the relay's sequence number, client frames carry 0.
+ * A SEALED frame carries nonce || ciphertext || tag with the encoded header as
+ * associated data.
+ *
+ * Large payloads travel as streams: STREAM_START, any number of STREAM_DATA chunks
+ * and STREAM_END. The relay grants the sender WINDOW credit per stream and returns
+ * it only after every receiver has been sent the chunk, so relay memory per stream
+ * is bounded by the window. Stream ids are chosen by the sender on the way in and
+ * by the relay on the way out.
+ *
+ * A relay with a multicast group announces it with MULTICAST, which also tells the
+ * client what it is not owed (up to the resume base) and up to which sequence the
+ * replay over TCP goes, so a joining client does not NACK either. A client that joined
+ * the group answers SUBSCRIBE, from then on sequenced broadcasts reach it only as
+ * datagrams holding the same frame. Lost sequences are requested with NACK and
+ * resent over TCP from the history; HEARTBEAT datagrams carry the newest sequence
+ * so a lost tail is noticed too.
+ *
+ * UPDATE frames carry keyed state and no sequence. The relay keeps the newest value
+ * per key, hands every value to a client right after its handshake and, while a
+ * client is behind, replaces a queued update with a newer one for the same key.
+ *
+ * HELLO ends with the compression codecs the client can decode, WELCOME with the one
+ * the relay picked (0 for none). With a codec picked, broadcasts may arrive with
+ * COMPRESSED set: the payload, before sealing, is the compressed text.
+ *
+ * Clients acknowledge sequenced broadcasts cumulatively with ACK, coalesced to one
+ * every few messages or milliseconds. A relay with reliable delivery keeps what is
+ * not acknowledged and replays it when the client resumes after a reconnect.
+ */
+
+enum {
+    PROTOCOL_VERSION = 4,
+    FRAME_HEADER_SIZE = 16,
+    FRAME_MAX_PAYLOAD = 65536,
+    HELLO_PAYLOAD_SIZE = 1 + CRYPTO_PUBLIC_KEY_SIZE + 8 + 8 + 1,
+    WELCOME_PAYLOAD_SIZE = 8 + 1,
+    WELCOME_SEALED_PAYLOAD_SIZE = WELCOME_PAYLOAD_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_KEY_SIZE + CRYPTO_SEAL_OVERHEAD,
+    STREAM_ID_SIZE = 4,
+    STREAM_START_PREFIX_SIZE = STREAM_ID_SIZE + 8,
+    STREAM_CHUNK_SIZE = 16384,
+    STREAM_INITIAL_WINDOW = 262144,
+    WINDOW_PAYLOAD_SIZE = STREAM_ID_SIZE + 4,
+    MULTICAST_PAYLOAD_SIZE = 4 + 2 + 8 + 8,
+    UPDATE_MAX_KEY_LENGTH = 255,
+    NACK_PAYLOAD_SIZE = 8 + 4,
+    ACK_PAYLOAD_SIZE = 8,
+    MULTICAST_MAX_DATAGRAM = 65507 // larger broadcasts stay on TCP
+};
+
+typedef enum {
+    FRAME_HELLO = 1,   // version, client public key, last seen epoch, last seen sequence
+    FRAME_WELCOME = 2, // epoch; if sealed also server public key, group key sealed with the session key
+    FRAME_TEXT = 3,
+    FRAME_STREAM_START = 4, // stream id, total size (0 if unknown), name; relayed with "ip:port/" before the name
+    FRAME_STREAM_DATA = 5,  // stream id, chunk
+    FRAME_STREAM_END = 6,   // stream id, status
+    FRAME_WINDOW = 7,       // stream id, additional bytes the sender may send (relay to sender only)
+    FRAME_MULTICAST = 8,    // group address, port (network order), resume base, newest sequence
+    FRAME_SUBSCRIBE = 9,    // client joined the group, no payload
+    FRAME_NACK = 10,        // first missing sequence, count
+    FRAME_HEARTBEAT = 11,   // datagram only, no payload, header sequence is the newest broadcast
+    FRAME_UPDATE = 12,      // key length (1), key, value; only the newest value per key matters
+    FRAME_ACK = 13          // newest sequence delivered, every earlier one was delivered too
+} FrameType;
+
+typedef enum {
+    STREAM_COMPLETE = 0,
+    STREAM_ABORTED = 1
+} StreamStatus;
+
+enum {
+    FRAME_FLAG_SEALED = 1 << 0,
+    FRAME_FLAG_PRIORITY = 1 << 1, // sent ahead of queued traffic, may overtake older sequences
+    FRAME_FLAG_COMPRESSED = 1 << 2
+};
+
+// compression codecs, as bits of the HELLO offer
+enum {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_LZ = 1 << 0 // utils/lz with its preset dictionary
+};
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t length;
+    uint64_t sequence;
+} FrameHeader;
+
+void Protocol_write_u32(uint8_t *out, uint32_t value);
+uint32_t Protocol_read_u32(const uint8_t *in);
+void Protocol_write_u64(uint8_t *out, uint64_t value);
+uint64_t Protocol_read_u64(const uint8_t *in);
+
+void Protocol_encode_header(const FrameHeader *header, uint8_t *out);
+void Protocol_decode_header(const uint8_t *in, FrameHeader *header);
+
+// writes a complete frame (header + payload) to a blocking descriptor
+ssize_t Protocol_send_frame(int file_descriptor, const FrameHeader *header, const void *payload, int *error_flag);
+
+// encodes header + payload, sealing the payload with state when it is not NULL;
+// out must hold FRAME_HEADER_SIZE + length + CRYPTO_SEAL_OVERHEAD bytes, returns frame size
+size_t Protocol_encode_frame(uint8_t type, uint64_t sequence, CipherState *state, const void *payload, size_t length,
+                             uint8_t *out, int *error_flag);
+
+// like Protocol_encode_frame with extra header flags, covered by the seal like the rest of the header
+size_t Protocol_encode_flagged_frame(uint8_t type, uint8_t flags, uint64_t sequence, CipherState *state,
+                                     const void *payload, size_t length, uint8_t *out, int *error_flag);
+
+// opens a sealed frame payload in place of out, returns plaintext length
+size_t Protocol_open_frame(const FrameHeader *header, const uint8_t *payload, const uint8_t key[CRYPTO_KEY_SIZE],
+                           uint8_t *out, uint64_t *nonce_counter, int *error_flag);
+
+// reassembles frames from a byte stream
+typedef struct FrameReader FrameReader;
+
+FrameReader *FrameReader_create(int *error_flag);
+void FrameReader_destroy(FrameReader *reader);
+
+// receives whatever is available from the socket, returns bytes read (0 on EOF);
+// with MSG_DONTWAIT in flags returns -1 without error_flag when there is nothing to read
+ssize_t FrameReader_fill(FrameReader *reader, int file_descriptor, int flags, int *error_flag);
+
+// drops buffered bytes, used when the connection is replaced
+void FrameReader_reset(FrameReader *reader);
+
+// returns 1 and points payload into the reader buffer when a full frame is buffered;
+// the payload stays valid until the next FrameReader call
+int FrameReader_next(FrameReader *reader, FrameHeader *header, const uint8_t **payload, int *error_flag);
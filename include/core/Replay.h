@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// replays a capture trace (see core/Trace.h) against a relay: every recorded connection
+// is opened as a Client and its frames are sent again on the recorded schedule
+typedef struct Replay Replay;
+
+typedef struct {
+    uint64_t connections;
+    uint64_t failed_connections;
+    uint64_t frames_sent;
+    uint64_t bytes_sent;          // payload bytes
+    uint64_t frames_skipped;      // belonged to a connection that failed or was dropped
+    uint64_t frames_ignored;      // SUBSCRIBE, NACK and ACK: about what the recorded connection received
+    uint64_t frames_received;     // relay frames delivered to the replayed connections
+    uint64_t recorded_duration_ns;
+    uint64_t replay_duration_ns;
+    // how late frames went out compared with their scaled recorded time (timed replay only)
+    uint64_t lag_mean_ns;
+    uint64_t lag_p50_ns;
+    uint64_t lag_p99_ns;
+    uint64_t lag_max_ns;
+} ReplayReport;
+
+Replay *Replay_create(const char *trace_path, const char *server_ip, int port, int *error_flag);
+void Replay_destroy(Replay *replay);
+
+// 1 (default) keeps the recorded pace, 2 replays twice as fast, 0 sends as fast as possible
+void Replay_set_speed(Replay *replay, double speed);
+
+void Replay_run(Replay *replay, int *error_flag);
+void Replay_get_report(const Replay *replay, ReplayReport *report);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Capture file: an 8 byte magic followed by records, all integers big-endian.
+ *
+ *   timestamp_ns(8) | connection_id(4) | event(1) | frame_type(1) | length(4) | payload
+ *
+ * Timestamps are CLOCK_MONOTONIC at the relay. FRAME records hold the opened
+ * (plaintext) payload of an inbound client frame, so a trace of an encrypted relay
+ * contains the messages in the clear.
+ */
+
+enum {
+    TRACE_RECORD_HEADER_SIZE = 8 + 4 + 1 + 1 + 4
+};
+
+typedef enum {
+    TRACE_CONNECT = 1,
+    TRACE_FRAME = 2,
+    TRACE_DISCONNECT = 3
+} TraceEvent;
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint32_t connection_id;
+    uint8_t event;
+    uint8_t frame_type; // FRAME records only
+    uint32_t length;
+} TraceRecord;
+
+typedef struct TraceWriter TraceWriter;
+typedef struct TraceReader TraceReader;
+
+TraceWriter *TraceWriter_create(const char *path, int *error_flag);
+// flushes buffered records
+void TraceWriter_destroy(TraceWriter *writer);
+void TraceWriter_write(TraceWriter *writer, const TraceRecord *record, const void *payload, int *error_flag);
+
+TraceReader *TraceReader_create(const char *path, int *error_flag);
+void TraceReader_destroy(TraceReader *reader);
+// payload must hold FRAME_MAX_PAYLOAD bytes; returns 0 at the end of the trace
+int TraceReader_next(TraceReader *reader, TraceRecord *record, uint8_t *payload, int *error_flag);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// CLOCK_MONOTONIC readings
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_monotonic_ms(void);
+
+// CPU time consumed by the calling thread
+uint64_t clock_thread_cpu_ns(void);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    CRYPTO_KEY_SIZE = 32,
+    CRYPTO_PUBLIC_KEY_SIZE = 32,
+    CRYPTO_NONCE_SIZE = 12,
+    CRYPTO_TAG_SIZE = 16,
+    CRYPTO_SEAL_OVERHEAD = CRYPTO_NONCE_SIZE + CRYPTO_TAG_SIZE
+};
+
+// key plus the counter used to build the next explicit nonce
+typedef struct {
+    uint8_t key[CRYPTO_KEY_SIZE];
+    uint64_t nonce_counter;
+} CipherState;
+
+void crypto_random_bytes(void *buffer, size_t count, int *error_flag);
+
+// X25519 ephemeral key pair
+void crypto_generate_keypair(uint8_t private_key[CRYPTO_KEY_SIZE], uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE], int *error_flag);
+
+// derives the client->server and server->client keys from an X25519 exchange;
+// both sides end up with the same pair
+void crypto_derive_session_keys(const uint8_t private_key[CRYPTO_KEY_SIZE],
+                                const uint8_t peer_public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                                int is_server,
+                                uint8_t client_to_server_key[CRYPTO_KEY_SIZE],
+                                uint8_t server_to_client_key[CRYPTO_KEY_SIZE],
+                                int *error_flag);
+
+// ChaCha20-Poly1305; output is nonce || ciphertext || tag (length + CRYPTO_SEAL_OVERHEAD bytes)
+size_t crypto_seal(CipherState *state, const uint8_t *aad, size_t aad_length,
+                   const uint8_t *plaintext, size_t length, uint8_t *out, int *error_flag);
+
+// returns plaintext length; nonce_counter receives the sender's counter for replay checks
+size_t crypto_open(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t *aad, size_t aad_length,
+                   const uint8_t *sealed, size_t sealed_length, uint8_t *out,
+                   uint64_t *nonce_counter, int *error_flag);
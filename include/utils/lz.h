@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Byte oriented LZ77 in the spirit of LZ4. The output is a run of sequences:
+ *
+ *   token (1) | extra literal length | literals | offset (2, LE) | extra match length
+ *
+ * The token holds the literal length in its high nibble and the match length minus
+ * LZ_MIN_MATCH in its low one, a nibble of 15 continues in 255-valued bytes. The last
+ * sequence stops after its literals. Both sides share a preset dictionary of common
+ * chat text that logically precedes the input, so short messages find matches too.
+ */
+
+enum {
+    LZ_MIN_MATCH = 4,
+    LZ_MAX_OFFSET = 65535
+};
+
+// returns the compressed size, or 0 if it does not fit into capacity
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+// returns the decompressed size; malformed input or output beyond capacity sets error_flag
+size_t lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity, int *error_flag);
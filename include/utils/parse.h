@@ -1,3 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 int parse_port(const char *arg, int *error_flag);
+size_t parse_size(const char *arg, int *error_flag);
+double parse_double(const char *arg, int *error_flag);
@@ -1,6 +1,12 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 ssize_t safe_read(int file_descriptor, void *buffer, size_t count, int *error_flag);
+// like safe_read with recv flags; returns -1 without setting error_flag when
+// a non-blocking call finds nothing to read
+ssize_t safe_recv(int file_descriptor, void *buffer, size_t count, int flags, int *error_flag);
 ssize_t safe_write(int file_descriptor, const void *buffer, size_t count, int *error_flag);
+// may modify iov while finishing partial writes
+ssize_t safe_writev(int file_descriptor, struct iovec *iov, int iov_count, int *error_flag);
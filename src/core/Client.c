@@ -1,21 +1,99 @@
+#define _GNU_SOURCE
+
 #include "core/Client.h"
+#include "core/Protocol.h"
+#include "utils/clock.h"
+#include "utils/crypto.h"
+#include "utils/lz.h"
 #include "utils/safe_io.h"
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "core/Console.h"
 
+enum {
+    RECONNECT_BASE_DELAY_MS = 100,
+    RECONNECT_MAX_DELAY_MS = 10000,
+    HANDSHAKE_TIMEOUT_MS = 5000, // connect plus HELLO -> WELCOME, a slower relay counts as down
+    MAX_PATH_LENGTH = 4096,
+    REORDER_CAPACITY = 256, // sequenced messages held back while an earlier one is missing
+    NACK_RETRY_MS = 200,
+    GAP_GIVE_UP_MS = 2000,  // a gap without repair progress for this long is reported as lost
+    ACK_BATCH = 64,         // an ACK goes out after this many messages,
+    ACK_DELAY_MS = 100,     // or this long after the first one it covers
+    MULTICAST_RECEIVE_BUFFER = 4 * 1024 * 1024 // absorbs bursts, capped by net.core.rmem_max
+};
+
+// sequenced text that arrived ahead of a gap
+typedef struct {
+    uint64_t sequence;
+    size_t length;
+    char text[];
+} PendingText;
+
+// file being sent, one at a time; chunks go out only while the relay granted window
+typedef struct {
+    int file_descriptor; // -1 when idle
+    uint32_t stream_id;
+    uint64_t remaining;
+    uint64_t window;
+    char name[256];
+} OutgoingStream;
+
+// file being received; data is discarded when no download directory is set
+typedef struct IncomingStream {
+    uint32_t stream_id;
+    int file_descriptor;
+    uint64_t received;
+    uint64_t total_size;
+    char name[512];
+    char path[MAX_PATH_LENGTH];
+    struct IncomingStream *next;
+} IncomingStream;
+
 struct Client {
     int socket_file_descriptor;
     struct sockaddr_in server_address;
     int is_connected;
+    FrameReader *reader;
+    int is_encrypted;
+    CipherState send_state;
+    uint8_t group_key[CRYPTO_KEY_SIZE];
+    uint64_t epoch;         // relay run the sequence below belongs to, 0 before the first WELCOME
+    uint64_t last_sequence; // newest broadcast shown
+    int reconnect_attempt;
+    uint64_t reconnect_deadline_ms;
+    OutgoingStream upload;
+    uint32_t next_stream_id;
+    IncomingStream *downloads;
+    char *download_directory;
+    int wants_multicast;           // join the relay's group when it announces one
+    int wants_compression;         // offer COMPRESSION_LZ in the HELLO
+    uint8_t codec;                 // picked by the relay, COMPRESSION_NONE if any
+    int multicast_file_descriptor; // -1 unless subscribed
+    PendingText *reorder[REORDER_CAPACITY]; // indexed by sequence % REORDER_CAPACITY
+    uint64_t highest_sequence;     // newest sequence known to exist
+    uint64_t nack_deadline_ms;     // 0 while there is no gap
+    uint64_t gap_deadline_ms;
+    uint64_t nack_sequence;        // last_sequence when the latest NACK went out
+    uint64_t replay_end;           // newest sequence the relay replays over TCP after a join
+    uint64_t shown_ahead[REORDER_CAPACITY]; // priority texts shown before older sequences arrived
+    uint64_t acked_sequence;       // newest sequence acknowledged to the relay
+    uint64_t ack_limit;            // last sequence before a gap given up on, 0 if none
+    uint64_t ack_deadline_ms;      // 0 while everything shown is acknowledged
+    int is_handshaking;            // HELLO sent, waiting for the WELCOME
+    uint64_t handshake_deadline_ms; // 0 unless a connection attempt is in progress
+    uint8_t hello_private_key[CRYPTO_KEY_SIZE]; // pairs with the public key of the HELLO in flight
 };
 
 Client *Client_create(const char *server_ip, int port, int *error_flag) {
@@ -38,32 +116,142 @@ Client *Client_create(const char *server_ip, int port, int *error_flag) {
 
     client->socket_file_descriptor = -1;
     client->is_connected = 0;
+    client->upload.file_descriptor = -1;
+    client->multicast_file_descriptor = -1;
     client->server_address.sin_family = AF_INET;
     client->server_address.sin_port = htons((uint16_t) port);
 
     if (inet_pton(AF_INET, server_ip, &client->server_address.sin_addr) != 1) {
         fprintf(stderr, "Invalid IP address: %s\n", server_ip);
+        free(client);
         if (error_flag) {
             *error_flag = 1;
         }
         return NULL;
     }
+
+    client->reader = FrameReader_create(error_flag);
+    if (!client->reader) {
+        free(client);
+        return NULL;
+    }
     return client;
 }
 
-void Client_connect(Client *client, int *error_flag) {
+// opens the handshake: a fresh key pair, and the resume point so the relay replays what was missed
+void Client_send_hello(Client *client, int *error_flag) {
     if (error_flag) {
         *error_flag = 0;
     }
-    
-    if (!client || client->is_connected) {
+
+    uint8_t hello[HELLO_PAYLOAD_SIZE];
+    int crypto_error = 0;
+    hello[0] = PROTOCOL_VERSION;
+    if (client->ack_limit) {
+        // resume from the gap: what was skipped comes again, and so does what followed it
+        client->last_sequence = client->ack_limit;
+        client->ack_limit = 0;
+    }
+    crypto_generate_keypair(client->hello_private_key, hello + 1, &crypto_error);
+    Protocol_write_u64(hello + 1 + CRYPTO_PUBLIC_KEY_SIZE, client->epoch);
+    Protocol_write_u64(hello + 1 + CRYPTO_PUBLIC_KEY_SIZE + 8, client->last_sequence);
+    hello[HELLO_PAYLOAD_SIZE - 1] = client->wants_compression ? COMPRESSION_LZ : COMPRESSION_NONE;
+    if (crypto_error) {
         if (error_flag) {
             *error_flag = 1;
         }
         return;
     }
-    
-    client->socket_file_descriptor = socket(AF_INET, SOCK_STREAM, 0);
+
+    FrameHeader header = {FRAME_HELLO, 0, HELLO_PAYLOAD_SIZE, 0};
+    int io_error = 0;
+    Protocol_send_frame(client->socket_file_descriptor, &header, hello, &io_error);
+    if (io_error && error_flag) {
+        *error_flag = 1;
+    }
+}
+
+// closes the handshake; in encrypted mode derives the session keys and unseals the group key
+void Client_accept_welcome(Client *client, const FrameHeader *header, const uint8_t *payload, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (header->type != FRAME_WELCOME || header->length < WELCOME_PAYLOAD_SIZE) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    client->codec = payload[8];
+    if (client->codec != COMPRESSION_NONE && !(client->wants_compression && client->codec == COMPRESSION_LZ)) {
+        if (error_flag) {
+            *error_flag = 1; // not what we offered
+        }
+        return;
+    }
+
+    uint64_t epoch = Protocol_read_u64(payload);
+    if (epoch != client->epoch) {
+        // relay restarted, its sequence numbers start over
+        client->epoch = epoch;
+        client->last_sequence = 0;
+        client->highest_sequence = 0;
+        memset(client->shown_ahead, 0, sizeof(client->shown_ahead));
+    }
+    // the relay resumes from last_sequence, it counts everything before as acknowledged
+    client->acked_sequence = client->last_sequence;
+    client->ack_deadline_ms = 0;
+
+    int crypto_error = 0;
+    client->is_encrypted = (header->flags & FRAME_FLAG_SEALED) != 0;
+    if (client->is_encrypted) {
+        uint8_t receive_key[CRYPTO_KEY_SIZE];
+        uint8_t aad[FRAME_HEADER_SIZE + WELCOME_PAYLOAD_SIZE + CRYPTO_PUBLIC_KEY_SIZE];
+        const uint8_t *server_public_key = payload + WELCOME_PAYLOAD_SIZE;
+
+        if (header->length != WELCOME_SEALED_PAYLOAD_SIZE) {
+            crypto_error = 1;
+        } else {
+            crypto_derive_session_keys(client->hello_private_key, server_public_key, 0, client->send_state.key,
+                                       receive_key, &crypto_error);
+        }
+
+        if (!crypto_error) {
+            Protocol_encode_header(header, aad);
+            memcpy(aad + FRAME_HEADER_SIZE, payload, WELCOME_PAYLOAD_SIZE + CRYPTO_PUBLIC_KEY_SIZE);
+            crypto_open(receive_key, aad, sizeof(aad), payload + WELCOME_PAYLOAD_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
+                        header->length - WELCOME_PAYLOAD_SIZE - CRYPTO_PUBLIC_KEY_SIZE, client->group_key, NULL, &crypto_error);
+        }
+        client->send_state.nonce_counter = 0;
+        memset(receive_key, 0, sizeof(receive_key));
+    }
+
+    if (crypto_error && error_flag) {
+        *error_flag = 1;
+    }
+}
+
+// gives up the connection attempt in progress, if any
+void Client_abandon_connection(Client *client) {
+    if (client->socket_file_descriptor >= 0) {
+        close(client->socket_file_descriptor);
+        client->socket_file_descriptor = -1;
+    }
+    client->is_handshaking = 0;
+    client->handshake_deadline_ms = 0;
+    memset(client->hello_private_key, 0, sizeof(client->hello_private_key));
+}
+
+// starts a non-blocking TCP connect, Client_advance_connection finishes it; used for the
+// first connection and every reconnect
+void Client_start_connection(Client *client, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    client->socket_file_descriptor = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (client->socket_file_descriptor < 0) {
         perror("socket");
         if (error_flag) {
@@ -71,23 +259,219 @@ void Client_connect(Client *client, int *error_flag) {
         }
         return;
     }
+
+    FrameReader_reset(client->reader);
+    client->is_handshaking = 0;
+    client->handshake_deadline_ms = clock_monotonic_ms() + HANDSHAKE_TIMEOUT_MS;
+    if (connect(client->socket_file_descriptor, (struct sockaddr *) &client->server_address, sizeof(client->server_address)) < 0
+        && errno != EINPROGRESS) {
+        int connect_errno = errno;
+        Client_abandon_connection(client);
+        errno = connect_errno;
+        if (error_flag) {
+            *error_flag = 1;
+        }
+    }
+}
+
+// is_ready: the socket became writable while connecting, or readable while waiting for
+// the WELCOME; fails once HANDSHAKE_TIMEOUT_MS passed without a WELCOME
+void Client_advance_connection(Client *client, int is_ready, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    int attempt_error = 0;
+    int attempt_errno = ETIMEDOUT;
+    if (is_ready && !client->is_handshaking) {
+        int socket_error = 0;
+        socklen_t length = sizeof(socket_error);
+        if (getsockopt(client->socket_file_descriptor, SOL_SOCKET, SO_ERROR, &socket_error, &length) < 0
+            || socket_error != 0) {
+            attempt_error = 1;
+            attempt_errno = socket_error ? socket_error : errno;
+        } else {
+            // connected: everything past the handshake writes with blocking calls
+            int flags = fcntl(client->socket_file_descriptor, F_GETFL);
+            fcntl(client->socket_file_descriptor, F_SETFL, flags & ~O_NONBLOCK);
+            Client_send_hello(client, &attempt_error);
+            client->is_handshaking = !attempt_error;
+            attempt_errno = EPROTO;
+        }
+    } else if (is_ready) {
+        FrameHeader header;
+        const uint8_t *payload = NULL;
+        int io_error = 0;
+        int frame_error = 0;
+        attempt_errno = EPROTO;
+        if (FrameReader_fill(client->reader, client->socket_file_descriptor, 0, &io_error) <= 0 || io_error) {
+            attempt_error = 1;
+        } else if (FrameReader_next(client->reader, &header, &payload, &frame_error)) {
+            Client_accept_welcome(client, &header, payload, &attempt_error);
+            if (!attempt_error) {
+                client->is_handshaking = 0;
+                client->handshake_deadline_ms = 0;
+                memset(client->hello_private_key, 0, sizeof(client->hello_private_key));
+                client->is_connected = 1;
+                client->reconnect_attempt = 0;
+                return;
+            }
+        } else {
+            attempt_error = frame_error;
+        }
+    }
+
+    if (!attempt_error && clock_monotonic_ms() >= client->handshake_deadline_ms) {
+        attempt_error = 1;
+        attempt_errno = ETIMEDOUT;
+    }
+    if (attempt_error) {
+        Client_abandon_connection(client);
+        errno = attempt_errno;
+        if (error_flag) {
+            *error_flag = 1;
+        }
+    }
+}
+
+// the descriptor set Client_advance_connection waits on, NULL when there is no attempt
+fd_set *Client_connection_wait_set(const Client *client, fd_set *read_set, fd_set *write_set) {
+    if (client->is_connected || client->socket_file_descriptor < 0) {
+        return NULL;
+    }
+    return client->is_handshaking ? read_set : write_set;
+}
+
+// blocks until connected, for at most HANDSHAKE_TIMEOUT_MS
+void Client_connect(Client *client, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
     
-    if (connect(client->socket_file_descriptor, (struct sockaddr *) &client->server_address, sizeof(client->server_address)) < 0) {
+    if (!client || client->is_connected) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    int open_error = 0;
+    Client_start_connection(client, &open_error);
+    while (!open_error && !client->is_connected) {
+        fd_set read_set;
+        fd_set write_set;
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        FD_SET(client->socket_file_descriptor, Client_connection_wait_set(client, &read_set, &write_set));
+
+        uint64_t now = clock_monotonic_ms();
+        uint64_t wait = client->handshake_deadline_ms > now ? client->handshake_deadline_ms - now : 0;
+        struct timeval timeout = {(time_t) (wait / 1000), (suseconds_t) (wait % 1000) * 1000};
+        int ready = select(client->socket_file_descriptor + 1, &read_set, &write_set, NULL, &timeout);
+        if (ready < 0 && errno != EINTR) {
+            int select_errno = errno;
+            Client_abandon_connection(client);
+            errno = select_errno;
+            open_error = 1;
+        } else {
+            Client_advance_connection(client, ready > 0, &open_error);
+        }
+    }
+    if (open_error) {
         perror("connect");
-        close(client->socket_file_descriptor);
-        client->socket_file_descriptor = -1;
         if (error_flag) {
             *error_flag = 1;
         }
         return;
     }
-    
-    client->is_connected = 1;
-    
-    char server_ip_string[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client->server_address.sin_addr, server_ip_string, sizeof(server_ip_string));
-    
-    printf("Connected to server %s:%d\n", server_ip_string, ntohs(client->server_address.sin_port));
+}
+
+void Client_close_download(IncomingStream *stream, int is_complete) {
+    if (stream->file_descriptor >= 0) {
+        close(stream->file_descriptor);
+        if (!is_complete) {
+            unlink(stream->path); // keep no partial files
+        }
+    }
+    free(stream);
+}
+
+void Client_close_upload(Client *client) {
+    if (client->upload.file_descriptor >= 0) {
+        close(client->upload.file_descriptor);
+        client->upload.file_descriptor = -1;
+    }
+}
+
+// transfers do not survive a reconnect: the relay aborts them on its side too
+void Client_abort_transfers(Client *client, Console *console) {
+    char line[BUFSIZ];
+    if (client->upload.file_descriptor >= 0) {
+        Client_close_upload(client);
+        if (console) {
+            snprintf(line, sizeof(line), "Sending %s aborted", client->upload.name);
+            Console_add_message(console, line);
+        }
+    }
+
+    while (client->downloads) {
+        IncomingStream *next = client->downloads->next;
+        if (console) {
+            snprintf(line, sizeof(line), "Receiving %s aborted", client->downloads->name);
+            Console_add_message(console, line);
+        }
+        Client_close_download(client->downloads, 0);
+        client->downloads = next;
+    }
+}
+
+void Client_clear_reorder(Client *client) {
+    for (int i = 0; i < REORDER_CAPACITY; ++i) {
+        free(client->reorder[i]);
+        client->reorder[i] = NULL;
+    }
+    client->highest_sequence = client->last_sequence;
+    client->nack_deadline_ms = 0;
+    client->gap_deadline_ms = 0;
+    client->replay_end = 0;
+}
+
+// held messages are dropped too, the resume after a reconnect sends them again
+void Client_leave_multicast(Client *client) {
+    if (client->multicast_file_descriptor >= 0) {
+        close(client->multicast_file_descriptor);
+        client->multicast_file_descriptor = -1;
+    }
+    Client_clear_reorder(client);
+}
+
+// drops the connection and schedules the first reconnect attempt
+void Client_disconnect(Client *client, Console *console) {
+    Client_abort_transfers(client, console);
+    Client_leave_multicast(client);
+    if (client->socket_file_descriptor >= 0) {
+        close(client->socket_file_descriptor);
+        client->socket_file_descriptor = -1;
+    }
+    client->is_connected = 0;
+    client->reconnect_attempt = 0;
+    client->reconnect_deadline_ms = clock_monotonic_ms();
+}
+
+// exponential backoff with full jitter: wait uniformly in [0, min(max, base * 2^attempt)]
+void Client_schedule_reconnect(Client *client) {
+    uint64_t ceiling = RECONNECT_MAX_DELAY_MS;
+    if (client->reconnect_attempt < 16) {
+        uint64_t doubled = (uint64_t) RECONNECT_BASE_DELAY_MS << client->reconnect_attempt;
+        if (doubled < ceiling) {
+            ceiling = doubled;
+        }
+    }
+    ++client->reconnect_attempt;
+
+    uint32_t random = 0;
+    crypto_random_bytes(&random, sizeof(random), NULL);
+    client->reconnect_deadline_ms = clock_monotonic_ms() + random % (ceiling + 1);
 }
 
 ssize_t Client_send(Client *client, const char *message, size_t len, int *error_flag) {
@@ -101,9 +485,20 @@ ssize_t Client_send(Client *client, const char *message, size_t len, int *error_
         }
         return -1;
     }
+
+    uint8_t frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    int encode_error = 0;
+    CipherState *state = client->is_encrypted ? &client->send_state : NULL;
+    size_t frame_length = Protocol_encode_frame(FRAME_TEXT, 0, state, message, len, frame, &encode_error);
+    if (encode_error) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return -1;
+    }
     
     int write_error = 0;
-    ssize_t result = safe_write(client->socket_file_descriptor, message, len, &write_error);
+    ssize_t result = safe_write(client->socket_file_descriptor, frame, frame_length, &write_error);
     
     if (write_error != 0 && error_flag) {
         *error_flag = write_error;
@@ -112,26 +507,853 @@ ssize_t Client_send(Client *client, const char *message, size_t len, int *error_
     return result;
 }
 
-ssize_t Client_receive(Client *client, char *buffer, size_t buffer_size, int *error_flag) {
+void Client_set_download_directory(Client *client, const char *directory, int *error_flag) {
     if (error_flag) {
         *error_flag = 0;
     }
-    
-    if (!client || !client->is_connected || !buffer || buffer_size == 0) {
+
+    char *copy = directory ? strdup(directory) : NULL;
+    if (directory && !copy) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+    free(client->download_directory);
+    client->download_directory = copy;
+}
+
+// announces the file; its data follows as the relay grants window
+void Client_send_file(Client *client, const char *path, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!client || !client->is_connected || !path || client->upload.file_descriptor >= 0) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    int file_descriptor = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat file_status;
+    if (file_descriptor < 0 || fstat(file_descriptor, &file_status) < 0 || !S_ISREG(file_status.st_mode)) {
+        if (file_descriptor >= 0) {
+            close(file_descriptor);
+        }
         if (error_flag) {
             *error_flag = 1;
         }
+        return;
+    }
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t name_length = strlen(name);
+    if (name_length >= sizeof(client->upload.name)) {
+        name_length = sizeof(client->upload.name) - 1;
+    }
+
+    OutgoingStream *upload = &client->upload;
+    upload->file_descriptor = file_descriptor;
+    upload->stream_id = client->next_stream_id++;
+    upload->remaining = (uint64_t) file_status.st_size;
+    upload->window = 0;
+    memcpy(upload->name, name, name_length);
+    upload->name[name_length] = '\0';
+
+    uint8_t start[STREAM_START_PREFIX_SIZE + sizeof(upload->name)];
+    Protocol_write_u32(start, upload->stream_id);
+    Protocol_write_u64(start + STREAM_ID_SIZE, upload->remaining);
+    memcpy(start + STREAM_START_PREFIX_SIZE, upload->name, name_length);
+
+    uint8_t frame[FRAME_HEADER_SIZE + sizeof(start) + CRYPTO_SEAL_OVERHEAD];
+    int io_error = 0;
+    CipherState *state = client->is_encrypted ? &client->send_state : NULL;
+    size_t frame_length = Protocol_encode_frame(FRAME_STREAM_START, 0, state, start, STREAM_START_PREFIX_SIZE + name_length,
+                                                frame, &io_error);
+    if (!io_error) {
+        safe_write(client->socket_file_descriptor, frame, frame_length, &io_error);
+    }
+    if (io_error) {
+        Client_close_upload(client);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+    }
+}
+
+void Client_send_update(Client *client, const char *key, const void *value, size_t value_length, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    size_t key_length = key ? strlen(key) : 0;
+    if (!client || key_length == 0 || key_length > UPDATE_MAX_KEY_LENGTH
+        || 1 + key_length + value_length > FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    payload[0] = (uint8_t) key_length;
+    memcpy(payload + 1, key, key_length);
+    memcpy(payload + 1 + key_length, value, value_length);
+    Client_send_frame(client, FRAME_UPDATE, payload, 1 + key_length + value_length, error_flag);
+}
+
+int Client_is_sending(const Client *client) {
+    return client->upload.file_descriptor >= 0 && client->upload.window > 0;
+}
+
+int Client_send_stream_frame(Client *client, uint8_t type, const uint8_t *payload, size_t length) {
+    uint8_t frame[FRAME_HEADER_SIZE + STREAM_ID_SIZE + 1 + CRYPTO_SEAL_OVERHEAD];
+    int io_error = 0;
+    CipherState *state = client->is_encrypted ? &client->send_state : NULL;
+    size_t frame_length = Protocol_encode_frame(type, 0, state, payload, length, frame, &io_error);
+    if (!io_error) {
+        safe_write(client->socket_file_descriptor, frame, frame_length, &io_error);
+    }
+    return io_error ? -1 : 0;
+}
+
+// plain mode: the header goes out corked and the file bytes follow straight
+// from the page cache; encrypted mode has to read the chunk to seal it
+int Client_send_chunk_data(Client *client, size_t chunk_length) {
+    OutgoingStream *upload = &client->upload;
+    int io_error = 0;
+
+    if (client->is_encrypted) {
+        uint8_t chunk[STREAM_ID_SIZE + STREAM_CHUNK_SIZE];
+        uint8_t frame[FRAME_HEADER_SIZE + sizeof(chunk) + CRYPTO_SEAL_OVERHEAD];
+        Protocol_write_u32(chunk, upload->stream_id);
+        if (safe_read(upload->file_descriptor, chunk + STREAM_ID_SIZE, chunk_length, &io_error) != (ssize_t) chunk_length) {
+            return -1;
+        }
+        size_t frame_length = Protocol_encode_frame(FRAME_STREAM_DATA, 0, &client->send_state, chunk,
+                                                    STREAM_ID_SIZE + chunk_length, frame, &io_error);
+        if (!io_error) {
+            safe_write(client->socket_file_descriptor, frame, frame_length, &io_error);
+        }
+        return io_error ? -1 : 0;
+    }
+
+    FrameHeader header = {FRAME_STREAM_DATA, 0, (uint32_t) (STREAM_ID_SIZE + chunk_length), 0};
+    uint8_t prefix[FRAME_HEADER_SIZE + STREAM_ID_SIZE];
+    Protocol_encode_header(&header, prefix);
+    Protocol_write_u32(prefix + FRAME_HEADER_SIZE, upload->stream_id);
+
+    size_t offset = 0;
+    while (offset < sizeof(prefix)) {
+        ssize_t sent = send(client->socket_file_descriptor, prefix + offset, sizeof(prefix) - offset, MSG_MORE | MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1;
+        }
+        offset += (size_t) sent;
+    }
+
+    size_t remaining = chunk_length;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(client->socket_file_descriptor, upload->file_descriptor, NULL, remaining);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1; // file shrank under us or the socket failed: the frame cannot be completed
+        }
+        remaining -= (size_t) sent;
+    }
+    return 0;
+}
+
+// sends one chunk within the window, or the end of the stream once the file is out
+int Client_send_chunk(Client *client, Console *console) {
+    OutgoingStream *upload = &client->upload;
+    char line[BUFSIZ];
+
+    if (upload->remaining == 0) {
+        uint8_t end[STREAM_ID_SIZE + 1];
+        Protocol_write_u32(end, upload->stream_id);
+        end[STREAM_ID_SIZE] = STREAM_COMPLETE;
+        Client_close_upload(client);
+        snprintf(line, sizeof(line), "Sent %s", upload->name);
+        Console_add_message(console, line);
+        Console_render(console);
+        return Client_send_stream_frame(client, FRAME_STREAM_END, end, sizeof(end));
+    }
+
+    size_t chunk_length = STREAM_CHUNK_SIZE;
+    if (chunk_length > upload->remaining) {
+        chunk_length = (size_t) upload->remaining;
+    }
+    if (chunk_length > upload->window) {
+        chunk_length = (size_t) upload->window;
+    }
+
+    if (Client_send_chunk_data(client, chunk_length) < 0) {
         return -1;
     }
-    
+    upload->remaining -= chunk_length;
+    upload->window -= chunk_length;
+    return 0;
+}
+
+void Client_handle_window(Client *client, const uint8_t *payload, size_t length) {
+    if (length < WINDOW_PAYLOAD_SIZE || client->upload.file_descriptor < 0
+        || Protocol_read_u32(payload) != client->upload.stream_id) {
+        return; // late credit for a finished stream
+    }
+    client->upload.window += Protocol_read_u32(payload + STREAM_ID_SIZE);
+}
+
+IncomingStream *Client_find_download(Client *client, uint32_t stream_id, IncomingStream ***link_out) {
+    IncomingStream **link = &client->downloads;
+    while (*link && (*link)->stream_id != stream_id) {
+        link = &(*link)->next;
+    }
+    if (link_out) {
+        *link_out = link;
+    }
+    return *link;
+}
+
+// the name comes from another client: only its last component is used and
+// anything outside a conservative character set is replaced
+void Client_open_download_file(Client *client, IncomingStream *stream) {
+    char safe_name[256];
+    const char *name = strrchr(stream->name, '/');
+    name = name ? name + 1 : stream->name;
+
+    size_t length = 0;
+    for (; name[length] && length < sizeof(safe_name) - 1; ++length) {
+        char c = name[length];
+        int is_safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                      || c == '.' || c == '-' || c == '_';
+        safe_name[length] = is_safe ? c : '_';
+    }
+    safe_name[length] = '\0';
+    if (length == 0 || safe_name[0] == '.') {
+        safe_name[0] = '_';
+        safe_name[length ? length : 1] = '\0';
+    }
+
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        if (attempt == 0) {
+            snprintf(stream->path, sizeof(stream->path), "%s/%s", client->download_directory, safe_name);
+        } else {
+            snprintf(stream->path, sizeof(stream->path), "%s/%s.%d", client->download_directory, safe_name, attempt);
+        }
+        stream->file_descriptor = open(stream->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (stream->file_descriptor >= 0 || errno != EEXIST) {
+            return;
+        }
+    }
+}
+
+void Client_handle_stream_start(Client *client, const uint8_t *payload, size_t length, Console *console) {
+    if (length < STREAM_START_PREFIX_SIZE) {
+        return;
+    }
+
+    uint32_t stream_id = Protocol_read_u32(payload);
+    if (Client_find_download(client, stream_id, NULL)) {
+        return;
+    }
+
+    IncomingStream *stream = calloc(1, sizeof(IncomingStream));
+    if (!stream) {
+        return;
+    }
+    stream->stream_id = stream_id;
+    stream->file_descriptor = -1;
+    stream->total_size = Protocol_read_u64(payload + STREAM_ID_SIZE);
+    size_t name_length = length - STREAM_START_PREFIX_SIZE;
+    if (name_length >= sizeof(stream->name)) {
+        name_length = sizeof(stream->name) - 1;
+    }
+    memcpy(stream->name, payload + STREAM_START_PREFIX_SIZE, name_length);
+    stream->name[name_length] = '\0';
+
+    if (client->download_directory) {
+        Client_open_download_file(client, stream);
+    }
+    stream->next = client->downloads;
+    client->downloads = stream;
+
+    char line[BUFSIZ];
+    snprintf(line, sizeof(line), "Receiving %s (%llu bytes)%s", stream->name, (unsigned long long) stream->total_size,
+             stream->file_descriptor >= 0 ? "" : ", discarding");
+    Console_add_message(console, line);
+    Console_render(console);
+}
+
+void Client_handle_stream_data(Client *client, const uint8_t *payload, size_t length) {
+    if (length < STREAM_ID_SIZE) {
+        return;
+    }
+
+    IncomingStream *stream = Client_find_download(client, Protocol_read_u32(payload), NULL);
+    if (!stream) {
+        return;
+    }
+
+    stream->received += length - STREAM_ID_SIZE;
+    if (stream->file_descriptor >= 0) {
+        int write_error = 0;
+        safe_write(stream->file_descriptor, payload + STREAM_ID_SIZE, length - STREAM_ID_SIZE, &write_error);
+        if (write_error) {
+            perror("write");
+            close(stream->file_descriptor);
+            unlink(stream->path);
+            stream->file_descriptor = -1;
+        }
+    }
+}
+
+void Client_handle_stream_end(Client *client, const uint8_t *payload, size_t length, Console *console) {
+    if (length < STREAM_ID_SIZE + 1) {
+        return;
+    }
+
+    IncomingStream **link = NULL;
+    IncomingStream *stream = Client_find_download(client, Protocol_read_u32(payload), &link);
+    if (!stream) {
+        return;
+    }
+    *link = stream->next;
+
+    char line[BUFSIZ];
+    int is_complete = payload[STREAM_ID_SIZE] == STREAM_COMPLETE;
+    if (!is_complete) {
+        snprintf(line, sizeof(line), "Receiving %s aborted", stream->name);
+    } else if (stream->file_descriptor >= 0) {
+        snprintf(line, sizeof(line), "Received %s (%llu bytes) -> %s", stream->name,
+                 (unsigned long long) stream->received, stream->path);
+    } else {
+        snprintf(line, sizeof(line), "Received %s (%llu bytes), discarded", stream->name,
+                 (unsigned long long) stream->received);
+    }
+    Client_close_download(stream, is_complete);
+    Console_add_message(console, line);
+    Console_render(console);
+}
+
+void Client_enable_multicast(Client *client) {
+    if (client) {
+        client->wants_multicast = 1;
+    }
+}
+
+void Client_enable_compression(Client *client) {
+    if (client) {
+        client->wants_compression = 1;
+    }
+}
+
+// joins the announced group on the interface the relay connection uses, then tells
+// the relay to stop sending sequenced broadcasts over TCP
+void Client_join_multicast(Client *client, const uint8_t *payload, size_t length, Console *console) {
+    if (!client->wants_multicast || client->multicast_file_descriptor >= 0 || length != MULTICAST_PAYLOAD_SIZE) {
+        return;
+    }
+
+    struct sockaddr_in group;
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    memcpy(&group.sin_addr.s_addr, payload, 4);
+    memcpy(&group.sin_port, payload + 4, 2);
+
+    struct sockaddr_in local;
+    socklen_t local_length = sizeof(local);
+    struct ip_mreq membership;
+    membership.imr_multiaddr = group.sin_addr;
+
+    int opt = 1;
+    int receive_buffer = MULTICAST_RECEIVE_BUFFER;
+    int file_descriptor = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (file_descriptor >= 0) {
+        setsockopt(file_descriptor, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+    }
+    int is_joined = file_descriptor >= 0
+                    && setsockopt(file_descriptor, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == 0
+                    && bind(file_descriptor, (struct sockaddr *) &group, sizeof(group)) == 0
+                    && getsockname(client->socket_file_descriptor, (struct sockaddr *) &local, &local_length) == 0;
+    if (is_joined) {
+        membership.imr_interface = local.sin_addr;
+        is_joined = setsockopt(file_descriptor, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) == 0;
+    }
+
+    int subscribe_error = 0;
+    if (is_joined) {
+        // nothing up to the resume base is owed, the rest up to replay_end comes over TCP
+        uint64_t resume_base = Protocol_read_u64(payload + 6);
+        client->replay_end = Protocol_read_u64(payload + 14);
+        if (client->last_sequence < resume_base) {
+            client->last_sequence = resume_base;
+        }
+        if (client->acked_sequence < resume_base) {
+            client->acked_sequence = resume_base;
+        }
+        client->multicast_file_descriptor = file_descriptor;
+        client->highest_sequence = client->last_sequence > client->replay_end ? client->last_sequence
+                                                                             : client->replay_end;
+        Client_send_frame(client, FRAME_SUBSCRIBE, "", 0, &subscribe_error);
+    } else if (file_descriptor >= 0) {
+        close(file_descriptor);
+    }
+
+    char group_ip[INET_ADDRSTRLEN];
+    char line[BUFSIZ];
+    inet_ntop(AF_INET, &group.sin_addr, group_ip, sizeof(group_ip));
+    snprintf(line, sizeof(line), is_joined ? "Receiving broadcasts from multicast group %s:%d"
+                                           : "Cannot join multicast group %s:%d, staying on TCP",
+             group_ip, ntohs(group.sin_port));
+    Console_add_message(console, line);
+    Console_render(console);
+}
+
+void Client_show_text(Console *console, const char *text, size_t length) {
+    char line[FRAME_MAX_PAYLOAD + 1];
+    memcpy(line, text, length);
+    line[length] = '\0';
+    Console_add_message(console, line);
+    Console_render(console);
+}
+
+void Client_show_update(Console *console, const uint8_t *payload, size_t length) {
+    if (length < 1 || payload[0] == 0 || payload[0] > length - 1) {
+        return;
+    }
+
+    char line[BUFSIZ];
+    size_t key_length = payload[0];
+    snprintf(line, sizeof(line), "%.*s = %.*s", (int) key_length, (const char *) payload + 1,
+             (int) (length - 1 - key_length), (const char *) payload + 1 + key_length);
+    Console_add_message(console, line);
+    Console_render(console);
+}
+
+void Client_send_nack(Client *client) {
+    uint64_t missing = client->highest_sequence - client->last_sequence;
+    uint8_t nack[NACK_PAYLOAD_SIZE];
+    Protocol_write_u64(nack, client->last_sequence + 1);
+    Protocol_write_u32(nack + 8, missing > UINT32_MAX ? UINT32_MAX : (uint32_t) missing);
+
+    int nack_error = 0;
+    Client_send_frame(client, FRAME_NACK, nack, sizeof(nack), &nack_error);
+    client->nack_deadline_ms = clock_monotonic_ms() + NACK_RETRY_MS;
+    client->nack_sequence = client->last_sequence;
+}
+
+int Client_was_shown_ahead(const Client *client, uint64_t sequence) {
+    return client->shown_ahead[sequence % REORDER_CAPACITY] == sequence;
+}
+
+// shows held messages that are next in sequence, closes the gap once nothing is missing
+void Client_deliver_pending(Client *client, Console *console) {
+    for (;;) {
+        uint64_t next = client->last_sequence + 1;
+        PendingText **slot = &client->reorder[next % REORDER_CAPACITY];
+        if (*slot && (*slot)->sequence == next) {
+            Client_show_text(console, (*slot)->text, (*slot)->length);
+            free(*slot);
+            *slot = NULL;
+            if (client->ack_limit) {
+                client->shown_ahead[next % REORDER_CAPACITY] = next; // the resume sends it again
+            }
+        } else if (!Client_was_shown_ahead(client, next)) {
+            break;
+        }
+        client->last_sequence = next;
+    }
+
+    if (client->highest_sequence <= client->last_sequence) {
+        client->highest_sequence = client->last_sequence;
+        client->nack_deadline_ms = 0;
+        client->gap_deadline_ms = 0;
+    }
+}
+
+void Client_open_gap(Client *client) {
+    // the TCP replay is still filling the range in order, asking for it again would duplicate it
+    if (client->nack_deadline_ms == 0 && client->last_sequence >= client->replay_end) {
+        client->gap_deadline_ms = clock_monotonic_ms() + GAP_GIVE_UP_MS;
+        Client_send_nack(client);
+    }
+}
+
+// gives up on everything missing up to sequence, held messages in between are shown;
+// acknowledgements stop before the first lost one so a reliable relay keeps it for the
+// resume, what is shown past it is remembered so the resume does not show it twice
+void Client_skip_gap(Client *client, uint64_t sequence, Console *console) {
+    uint64_t lost = 0;
+    uint64_t scan_end = sequence;
+    if (scan_end - client->last_sequence > REORDER_CAPACITY) {
+        scan_end = client->last_sequence + REORDER_CAPACITY; // nothing is held further ahead
+    }
+
+    while (client->last_sequence < scan_end) {
+        PendingText **slot = &client->reorder[++client->last_sequence % REORDER_CAPACITY];
+        if (*slot && (*slot)->sequence == client->last_sequence) {
+            Client_show_text(console, (*slot)->text, (*slot)->length);
+            free(*slot);
+            *slot = NULL;
+            if (client->ack_limit) {
+                client->shown_ahead[client->last_sequence % REORDER_CAPACITY] = client->last_sequence;
+            }
+        } else if (!Client_was_shown_ahead(client, client->last_sequence)) {
+            if (!client->ack_limit) {
+                client->ack_limit = client->last_sequence - 1;
+            }
+            ++lost;
+        }
+    }
+    if (sequence > client->last_sequence) {
+        if (!client->ack_limit) {
+            client->ack_limit = client->last_sequence;
+        }
+        lost += sequence - client->last_sequence;
+    }
+    client->last_sequence = sequence;
+
+    if (lost > 0) {
+        char line[BUFSIZ];
+        snprintf(line, sizeof(line), "%llu message(s) lost", (unsigned long long) lost);
+        Console_add_message(console, line);
+    }
+    Client_deliver_pending(client, console);
+    Console_render(console);
+}
+
+// sequenced texts are shown in order: over TCP they are, except priority texts that
+// overtook queued ones and are shown right away; multicast may lose or reorder them,
+// so later ones wait while the gap is repaired
+// over TCP a gap means the relay shed messages while overloaded, they are not coming
+void Client_report_missed(Client *client, uint64_t sequence, Console *console) {
+    uint64_t missed = sequence - client->last_sequence - 1;
+    uint64_t first = sequence - client->last_sequence > REORDER_CAPACITY ? sequence - REORDER_CAPACITY
+                                                                        : client->last_sequence + 1;
+    for (uint64_t skipped = first; skipped < sequence; ++skipped) {
+        if (Client_was_shown_ahead(client, skipped)) {
+            --missed; // a priority message that overtook the rest
+        }
+    }
+    if (missed > 0) {
+        char line[64];
+        int line_length = snprintf(line, sizeof(line), "[%llu message(s) missed]", (unsigned long long) missed);
+        Client_show_text(console, line, (size_t) line_length);
+    }
+}
+
+void Client_accept_text(Client *client, uint64_t sequence, int is_priority, const uint8_t *text, size_t length,
+                        Console *console) {
+    if (sequence == 0) {
+        Client_show_text(console, (const char *) text, length);
+        return;
+    }
+    if (sequence <= client->last_sequence) {
+        return; // already shown before the reconnect or repaired twice
+    }
+    if (Client_was_shown_ahead(client, sequence)) {
+        if (sequence == client->last_sequence + 1) {
+            Client_deliver_pending(client, console); // moves past it and whatever else was shown
+        }
+        return;
+    }
+
+    if (client->multicast_file_descriptor < 0 && is_priority && sequence != client->last_sequence + 1) {
+        // older sequences are still on their way, last_sequence moves past this one once they arrive
+        Client_show_text(console, (const char *) text, length);
+        client->shown_ahead[sequence % REORDER_CAPACITY] = sequence;
+        return;
+    }
+
+    if (client->multicast_file_descriptor < 0 || sequence == client->last_sequence + 1) {
+        if (client->last_sequence != 0 && sequence > client->last_sequence + 1) {
+            Client_report_missed(client, sequence, console);
+        }
+        Client_show_text(console, (const char *) text, length);
+        client->last_sequence = sequence;
+        if (client->highest_sequence < sequence) {
+            client->highest_sequence = sequence;
+        }
+        Client_deliver_pending(client, console);
+        return;
+    }
+
+    // beyond the reorder window the message is not held, the NACK range covers it
+    PendingText **slot = &client->reorder[sequence % REORDER_CAPACITY];
+    if (!*slot && sequence - client->last_sequence <= REORDER_CAPACITY) {
+        *slot = malloc(sizeof(PendingText) + length);
+        if (*slot) {
+            (*slot)->sequence = sequence;
+            (*slot)->length = length;
+            memcpy((*slot)->text, text, length);
+        }
+    }
+    if (client->highest_sequence < sequence) {
+        client->highest_sequence = sequence;
+    }
+    Client_open_gap(client);
+}
+
+void Client_handle_heartbeat(Client *client, uint64_t sequence) {
+    if (sequence > client->highest_sequence) {
+        client->highest_sequence = sequence;
+    }
+    if (client->highest_sequence > client->last_sequence) {
+        Client_open_gap(client);
+    }
+}
+
+// acknowledges everything delivered without a gap, batched: once ACK_BATCH messages
+// are pending or the oldest of them waited ACK_DELAY_MS, or right away if is_due
+void Client_service_ack(Client *client, int is_due) {
+    uint64_t delivered = client->last_sequence;
+    if (client->ack_limit && delivered > client->ack_limit) {
+        delivered = client->ack_limit;
+    }
+    if (delivered <= client->acked_sequence) {
+        return;
+    }
+
+    uint64_t now = clock_monotonic_ms();
+    if (client->ack_deadline_ms == 0) {
+        client->ack_deadline_ms = now + ACK_DELAY_MS;
+    }
+    if (!is_due && delivered - client->acked_sequence < ACK_BATCH && now < client->ack_deadline_ms) {
+        return;
+    }
+
+    uint8_t ack[ACK_PAYLOAD_SIZE];
+    Protocol_write_u64(ack, delivered);
+    int ack_error = 0;
+    Client_send_frame(client, FRAME_ACK, ack, sizeof(ack), &ack_error);
+    client->acked_sequence = delivered;
+    client->ack_deadline_ms = 0;
+}
+
+// retries NACKs and gives up on gaps that made no progress for too long
+void Client_service_gap(Client *client, Console *console) {
+    if (client->nack_deadline_ms == 0) {
+        return;
+    }
+
+    uint64_t now = clock_monotonic_ms();
+    if (now >= client->nack_deadline_ms && client->last_sequence > client->nack_sequence) {
+        // repairs are still arriving, asking again would only duplicate them
+        client->nack_deadline_ms = now + NACK_RETRY_MS;
+        client->gap_deadline_ms = now + GAP_GIVE_UP_MS;
+        client->nack_sequence = client->last_sequence;
+    } else if (now >= client->gap_deadline_ms) {
+        Client_skip_gap(client, client->highest_sequence, console);
+        if (client->ack_limit) {
+            // acknowledgements are stuck at the gap until a resume fetches it over TCP,
+            // or lifts the client past it if the relay no longer has it
+            char line[BUFSIZ];
+            snprintf(line, sizeof(line), "Resuming after message %llu to recover lost messages",
+                     (unsigned long long) client->ack_limit);
+            Console_add_message(console, line);
+            Client_service_ack(client, 1); // the resume then takes over the relay's hold on the ring
+            Client_disconnect(client, console);
+        }
+    } else if (now >= client->nack_deadline_ms) {
+        Client_send_nack(client);
+    }
+}
+
+// checks sealing and, in encrypted mode, opens the payload, then decompresses it if it
+// is compressed; -1 for frames to drop
+int Client_open_payload(const Client *client, const FrameHeader *header, const uint8_t *payload, uint8_t *plaintext,
+                        size_t *length) {
+    int is_sealed = (header->flags & FRAME_FLAG_SEALED) != 0;
+    int is_compressed = (header->flags & FRAME_FLAG_COMPRESSED) != 0;
+    if (is_sealed != client->is_encrypted || (is_compressed && client->codec == COMPRESSION_NONE)) {
+        return -1;
+    }
+
+    uint8_t packed[FRAME_MAX_PAYLOAD];
+    uint8_t *out = is_compressed ? packed : plaintext;
+    if (is_sealed) {
+        int open_error = 0;
+        *length = Protocol_open_frame(header, payload, client->group_key, out, NULL, &open_error);
+        if (open_error) {
+            return -1; // not authentic, drop
+        }
+    } else {
+        *length = header->length;
+        memcpy(out, payload, *length);
+    }
+
+    if (is_compressed) {
+        int decompress_error = 0;
+        *length = lz_decompress(packed, *length, plaintext, FRAME_MAX_PAYLOAD, &decompress_error);
+        return decompress_error ? -1 : 0;
+    }
+    return 0;
+}
+
+// next buffered frame from the relay, opened in encrypted mode; frames that are not
+// authentic are skipped; returns 0 when no complete frame is buffered
+int Client_next_frame(Client *client, FrameHeader *header, uint8_t *plaintext, size_t *length, int *frame_error) {
+    const uint8_t *payload = NULL;
+
+    while (FrameReader_next(client->reader, header, &payload, frame_error)) {
+        if (Client_open_payload(client, header, payload, plaintext, length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void Client_handle_frame(Client *client, const FrameHeader *header, const uint8_t *plaintext, size_t length,
+                         Console *console) {
+    switch (header->type) {
+        case FRAME_TEXT:
+            Client_accept_text(client, header->sequence, (header->flags & FRAME_FLAG_PRIORITY) != 0, plaintext, length,
+                               console);
+            break;
+        case FRAME_WINDOW:
+            Client_handle_window(client, plaintext, length);
+            break;
+        case FRAME_STREAM_START:
+            Client_handle_stream_start(client, plaintext, length, console);
+            break;
+        case FRAME_STREAM_DATA:
+            Client_handle_stream_data(client, plaintext, length);
+            break;
+        case FRAME_STREAM_END:
+            Client_handle_stream_end(client, plaintext, length, console);
+            break;
+        case FRAME_MULTICAST:
+            Client_join_multicast(client, plaintext, length, console);
+            break;
+        case FRAME_UPDATE:
+            Client_show_update(console, plaintext, length);
+            break;
+        default:
+            break;
+    }
+}
+
+// handles every buffered frame, returns -1 on protocol violation
+int Client_process_frames(Client *client, Console *console) {
+    FrameHeader header;
+    size_t length = 0;
+    int frame_error = 0;
+    uint8_t plaintext[FRAME_MAX_PAYLOAD];
+
+    while (Client_next_frame(client, &header, plaintext, &length, &frame_error)) {
+        Client_handle_frame(client, &header, plaintext, length, console);
+    }
+
+    return frame_error ? -1 : 0;
+}
+
+// handles queued group datagrams; each holds one complete broadcast or heartbeat frame
+void Client_receive_multicast(Client *client, Console *console) {
+    uint8_t datagram[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    uint8_t plaintext[FRAME_MAX_PAYLOAD];
+
+    for (;;) {
+        ssize_t received = recv(client->multicast_file_descriptor, datagram, sizeof(datagram), MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        FrameHeader header;
+        size_t length = 0;
+        if ((size_t) received < FRAME_HEADER_SIZE) {
+            continue;
+        }
+        Protocol_decode_header(datagram, &header);
+        if (header.length != (size_t) received - FRAME_HEADER_SIZE
+            || Client_open_payload(client, &header, datagram + FRAME_HEADER_SIZE, plaintext, &length) < 0) {
+            continue;
+        }
+
+        if (header.type == FRAME_TEXT) {
+            Client_accept_text(client, header.sequence, (header.flags & FRAME_FLAG_PRIORITY) != 0, plaintext, length,
+                               console);
+        } else if (header.type == FRAME_HEARTBEAT) {
+            Client_handle_heartbeat(client, header.sequence);
+        }
+    }
+}
+
+int Client_get_file_descriptor(const Client *client) {
+    return client ? client->socket_file_descriptor : -1;
+}
+
+void Client_send_frame(Client *client, uint8_t type, const void *payload, size_t length, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!client || !client->is_connected || length > FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    uint8_t frame[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    int io_error = 0;
+    CipherState *state = client->is_encrypted ? &client->send_state : NULL;
+    size_t frame_length = Protocol_encode_frame(type, 0, state, payload, length, frame, &io_error);
+    if (!io_error) {
+        safe_write(client->socket_file_descriptor, frame, frame_length, &io_error);
+    }
+    if (io_error && error_flag) {
+        *error_flag = 1;
+    }
+}
+
+void Client_receive(Client *client, ClientFrameHandler handler, void *context, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!client || !client->is_connected) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
     int read_error = 0;
-    ssize_t result = safe_read(client->socket_file_descriptor, buffer, buffer_size, &read_error);
-    
-    if (read_error != 0 && error_flag) {
-        *error_flag = read_error;
+    ssize_t received = FrameReader_fill(client->reader, client->socket_file_descriptor, MSG_DONTWAIT, &read_error);
+    if (received < 0 && !read_error) {
+        return; // nothing to read yet
+    }
+
+    FrameHeader header;
+    size_t length = 0;
+    int frame_error = 0;
+    uint8_t plaintext[FRAME_MAX_PAYLOAD];
+    while (received > 0 && Client_next_frame(client, &header, plaintext, &length, &frame_error)) {
+        handler(context, header.type, header.sequence, plaintext, length);
+        if (header.type == FRAME_TEXT && !(header.flags & FRAME_FLAG_PRIORITY) && header.sequence > client->last_sequence) {
+            client->last_sequence = header.sequence; // in order over TCP, priority texts overtake
+        }
+    }
+    // callers poll only while traffic flows, so each batch read is acknowledged at once
+    Client_service_ack(client, 1);
+
+    if (received <= 0 || read_error || frame_error) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
     }
-    
-    return result;
 }
 
 void Client_destroy(Client *client) {
@@ -143,6 +1365,13 @@ void Client_destroy(Client *client) {
         close(client->socket_file_descriptor);
     }
     
+    Client_abort_transfers(client, NULL);
+    Client_leave_multicast(client);
+    free(client->download_directory);
+    FrameReader_destroy(client->reader);
+    memset(&client->send_state, 0, sizeof(client->send_state));
+    memset(client->group_key, 0, sizeof(client->group_key));
+    memset(client->hello_private_key, 0, sizeof(client->hello_private_key));
     free(client);
 }
 
@@ -155,13 +1384,6 @@ void Client_run(Client *client, int *error_flag) {
         *error_flag = 0;
     }
 
-    int max_file_descriptor;
-    if (client->socket_file_descriptor > STDIN_FILENO) {
-        max_file_descriptor = client->socket_file_descriptor;
-    } else {
-        max_file_descriptor = STDIN_FILENO;
-    }
-    
     char buffer[BUFSIZ];
 
     int create_console_error = 0;
@@ -179,15 +1401,61 @@ void Client_run(Client *client, int *error_flag) {
         Console_add_message(console, "");
     }
     Console_render(console);
+    Client_process_frames(client, console);
     
     int is_running = 1;
     while (is_running) {
         fd_set read_file_descriptor_set;
+        fd_set write_file_descriptor_set;
         FD_ZERO(&read_file_descriptor_set);
+        FD_ZERO(&write_file_descriptor_set);
         FD_SET(STDIN_FILENO, &read_file_descriptor_set);
-        FD_SET(client->socket_file_descriptor, &read_file_descriptor_set);
 
-        int ready = select(max_file_descriptor + 1, &read_file_descriptor_set, NULL, NULL, NULL);
+        int max_file_descriptor = STDIN_FILENO;
+        uint64_t deadline = 0; // 0 waits for input only
+        if (client->is_connected) {
+            FD_SET(client->socket_file_descriptor, &read_file_descriptor_set);
+            if (Client_is_sending(client)) {
+                FD_SET(client->socket_file_descriptor, &write_file_descriptor_set);
+            }
+            if (client->socket_file_descriptor > max_file_descriptor) {
+                max_file_descriptor = client->socket_file_descriptor;
+            }
+            if (client->multicast_file_descriptor >= 0) {
+                FD_SET(client->multicast_file_descriptor, &read_file_descriptor_set);
+                if (client->multicast_file_descriptor > max_file_descriptor) {
+                    max_file_descriptor = client->multicast_file_descriptor;
+                }
+            }
+            if (client->nack_deadline_ms != 0) {
+                deadline = client->nack_deadline_ms < client->gap_deadline_ms ? client->nack_deadline_ms
+                                                                             : client->gap_deadline_ms;
+            }
+            if (client->ack_deadline_ms != 0 && (deadline == 0 || client->ack_deadline_ms < deadline)) {
+                deadline = client->ack_deadline_ms;
+            }
+        } else if (client->socket_file_descriptor >= 0) {
+            FD_SET(client->socket_file_descriptor,
+                   Client_connection_wait_set(client, &read_file_descriptor_set, &write_file_descriptor_set));
+            if (client->socket_file_descriptor > max_file_descriptor) {
+                max_file_descriptor = client->socket_file_descriptor;
+            }
+            deadline = client->handshake_deadline_ms;
+        } else {
+            deadline = client->reconnect_deadline_ms;
+        }
+
+        struct timeval timeout;
+        struct timeval *timeout_pointer = NULL;
+        if (deadline != 0) {
+            uint64_t now = clock_monotonic_ms();
+            uint64_t wait = deadline > now ? deadline - now : 0;
+            timeout.tv_sec = (time_t) (wait / 1000);
+            timeout.tv_usec = (suseconds_t) (wait % 1000) * 1000;
+            timeout_pointer = &timeout;
+        }
+
+        int ready = select(max_file_descriptor + 1, &read_file_descriptor_set, &write_file_descriptor_set, NULL, timeout_pointer);
         if (ready < 0) {
             if (errno == EINTR) {
                 continue;
@@ -196,6 +1464,30 @@ void Client_run(Client *client, int *error_flag) {
             break;
         }
 
+        if (!client->is_connected && client->socket_file_descriptor >= 0) {
+            // the connection attempt runs alongside the console, a dead relay cannot freeze it
+            int open_error = 0;
+            Client_advance_connection(client,
+                                      FD_ISSET(client->socket_file_descriptor, &read_file_descriptor_set)
+                                          || FD_ISSET(client->socket_file_descriptor, &write_file_descriptor_set),
+                                      &open_error);
+            if (open_error) {
+                Client_schedule_reconnect(client);
+            } else if (client->is_connected) {
+                Console_add_message(console, "Reconnected to server");
+                Console_render(console);
+                if (Client_process_frames(client, console) < 0) {
+                    Client_disconnect(client, console);
+                }
+            }
+        } else if (!client->is_connected && clock_monotonic_ms() >= client->reconnect_deadline_ms) {
+            int open_error = 0;
+            Client_start_connection(client, &open_error);
+            if (open_error) {
+                Client_schedule_reconnect(client);
+            }
+        }
+
         if (FD_ISSET(STDIN_FILENO, &read_file_descriptor_set)) {
             if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
                 is_running = 0;
@@ -208,25 +1500,79 @@ void Client_run(Client *client, int *error_flag) {
                 break;
             }
 
+            if (!client->is_connected) {
+                Console_add_message(console, "Not connected, message not sent");
+                Console_render(console);
+                continue;
+            }
+
+            if (strncmp(buffer, "sendfile(", 9) == 0 && length > 11 && strcmp(buffer + length - 2, ")\n") == 0) {
+                buffer[length - 2] = '\0';
+                int file_error = 0;
+                Client_send_file(client, buffer + 9, &file_error);
+                char line[BUFSIZ];
+                if (file_error) {
+                    snprintf(line, sizeof(line), "Cannot send %.*s", (int) (sizeof(line) - 16), buffer + 9);
+                } else {
+                    snprintf(line, sizeof(line), "Sending %s (%llu bytes)", client->upload.name,
+                             (unsigned long long) client->upload.remaining);
+                }
+                Console_add_message(console, line);
+                Console_render(console);
+                continue;
+            }
+
+            char *assignment = strstr(buffer, ")=");
+            if (strncmp(buffer, "set(", 4) == 0 && assignment && assignment > buffer + 4) {
+                // set(<key>)=<value>
+                *assignment = '\0';
+                buffer[length - 1] = '\0';
+                int update_error = 0;
+                Client_send_update(client, buffer + 4, assignment + 2, strlen(assignment + 2), &update_error);
+                if (update_error) {
+                    Console_add_message(console, "Update not sent");
+                    Console_render(console);
+                }
+                continue;
+            }
+
             int send_error = 0;
             ssize_t sent = Client_send(client, buffer, length, &send_error);
             if (send_error != 0 || sent < 0) {
-                perror("Failed to send message");
-                printf("Server disconnected\n");
-                break;
+                Console_add_message(console, "Server disconnected, reconnecting...");
+                Console_render(console);
+                Client_disconnect(client, console);
+                continue;
             }
         }
 
-        if (FD_ISSET(client->socket_file_descriptor, &read_file_descriptor_set)) {
-            ssize_t received = recv(client->socket_file_descriptor, buffer, sizeof(buffer) - 1, 0);
-            if (received <= 0) {
-                printf("Server disconnected\n");
-                is_running = 0;
-                break;
+        if (client->is_connected && FD_ISSET(client->socket_file_descriptor, &read_file_descriptor_set)) {
+            int read_error = 0;
+            ssize_t received = FrameReader_fill(client->reader, client->socket_file_descriptor, 0, &read_error);
+            if (received <= 0 || read_error || Client_process_frames(client, console) < 0) {
+                Console_add_message(console, "Server disconnected, reconnecting...");
+                Console_render(console);
+                Client_disconnect(client, console);
             }
-            buffer[received] = '\0';
-            Console_add_message(console, buffer);
+        }
+
+        if (client->is_connected && client->multicast_file_descriptor >= 0) {
+            if (FD_ISSET(client->multicast_file_descriptor, &read_file_descriptor_set)) {
+                Client_receive_multicast(client, console);
+            }
+            Client_service_gap(client, console);
+        }
+
+        if (client->is_connected) {
+            Client_service_ack(client, 0);
+        }
+
+        if (client->is_connected && Client_is_sending(client)
+            && FD_ISSET(client->socket_file_descriptor, &write_file_descriptor_set)
+            && Client_send_chunk(client, console) < 0) {
+            Console_add_message(console, "Server disconnected, reconnecting...");
             Console_render(console);
+            Client_disconnect(client, console);
         }
     }
 
@@ -236,4 +1582,3 @@ void Client_run(Client *client, int *error_flag) {
     Console_destroy(console);
     printf("Exited successfully.\n");
 }
-
@@ -0,0 +1,166 @@
+#include "core/LastValueCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    INITIAL_INDEX_CAPACITY = 64 // power of two, kept at least twice the key count
+};
+
+typedef struct {
+    uint8_t *key;
+    size_t key_length;
+    uint64_t hash;
+    Message *value;
+} CacheEntry;
+
+struct LastValueCache {
+    CacheEntry *entries; // entries[n - 1] holds key number n
+    size_t count;
+    size_t entry_capacity;
+    size_t max_keys;
+    uint32_t *index; // open addressing over key numbers, 0 marks a free slot
+    size_t index_capacity;
+};
+
+// FNV-1a
+uint64_t LastValueCache_hash(const uint8_t *key, size_t key_length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key_length; ++i) {
+        hash = (hash ^ key[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+LastValueCache *LastValueCache_create(size_t max_keys, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    LastValueCache *cache = calloc(1, sizeof(LastValueCache));
+    if (!cache || max_keys == 0 || max_keys > UINT32_MAX) {
+        free(cache);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    cache->index = calloc(INITIAL_INDEX_CAPACITY, sizeof(uint32_t));
+    if (!cache->index) {
+        free(cache);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    cache->index_capacity = INITIAL_INDEX_CAPACITY;
+    cache->max_keys = max_keys;
+    return cache;
+}
+
+void LastValueCache_destroy(LastValueCache *cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->count; ++i) {
+        free(cache->entries[i].key);
+        Message_release(cache->entries[i].value);
+    }
+    free(cache->entries);
+    free(cache->index);
+    free(cache);
+}
+
+// slot of the key in the index, or of the free slot where it belongs
+size_t LastValueCache_find_slot(const LastValueCache *cache, const uint8_t *key, size_t key_length, uint64_t hash) {
+    size_t mask = cache->index_capacity - 1;
+    size_t slot = (size_t) hash & mask;
+    while (cache->index[slot] != 0) {
+        const CacheEntry *entry = &cache->entries[cache->index[slot] - 1];
+        if (entry->hash == hash && entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+int LastValueCache_grow(LastValueCache *cache) {
+    if (cache->count == cache->entry_capacity) {
+        size_t capacity = cache->entry_capacity ? cache->entry_capacity * 2 : INITIAL_INDEX_CAPACITY / 2;
+        CacheEntry *entries = realloc(cache->entries, capacity * sizeof(CacheEntry));
+        if (!entries) {
+            return -1;
+        }
+        cache->entries = entries;
+        cache->entry_capacity = capacity;
+    }
+
+    if ((cache->count + 1) * 2 <= cache->index_capacity) {
+        return 0;
+    }
+
+    size_t capacity = cache->index_capacity * 2;
+    uint32_t *index = calloc(capacity, sizeof(uint32_t));
+    if (!index) {
+        return -1;
+    }
+    for (size_t i = 0; i < cache->count; ++i) {
+        size_t slot = (size_t) cache->entries[i].hash & (capacity - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        index[slot] = (uint32_t) (i + 1);
+    }
+    free(cache->index);
+    cache->index = index;
+    cache->index_capacity = capacity;
+    return 0;
+}
+
+int LastValueCache_store(LastValueCache *cache, const uint8_t *key, size_t key_length, Message *message) {
+    uint64_t hash = LastValueCache_hash(key, key_length);
+    size_t slot = LastValueCache_find_slot(cache, key, key_length, hash);
+
+    if (cache->index[slot] != 0) {
+        CacheEntry *entry = &cache->entries[cache->index[slot] - 1];
+        Message_release(entry->value);
+        entry->value = Message_retain(message);
+        message->key = cache->index[slot];
+        return 0;
+    }
+
+    if (cache->count == cache->max_keys || LastValueCache_grow(cache) < 0) {
+        return -1;
+    }
+    uint8_t *key_copy = malloc(key_length ? key_length : 1);
+    if (!key_copy) {
+        return -1;
+    }
+    memcpy(key_copy, key, key_length);
+
+    // growing may have rebuilt the index
+    slot = LastValueCache_find_slot(cache, key, key_length, hash);
+    CacheEntry *entry = &cache->entries[cache->count++];
+    entry->key = key_copy;
+    entry->key_length = key_length;
+    entry->hash = hash;
+    entry->value = Message_retain(message);
+    cache->index[slot] = (uint32_t) cache->count;
+    message->key = (uint32_t) cache->count;
+    return 0;
+}
+
+size_t LastValueCache_count(const LastValueCache *cache) {
+    return cache->count;
+}
+
+Message *LastValueCache_get(const LastValueCache *cache, uint32_t key) {
+    if (key == 0 || key > cache->count) {
+        return NULL;
+    }
+    return cache->entries[key - 1].value;
+}
@@ -0,0 +1,70 @@
+#include "core/Message.h"
+
+#include <stdlib.h>
+
+Message *Message_create(size_t capacity, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    // frame bytes live right after the struct
+    Message *message = malloc(sizeof(Message) + capacity);
+    if (!message) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    message->reference_count = 1;
+    message->sequence = 0;
+    message->key = 0;
+    message->length = 0;
+    message->payload_length = 0;
+    message->data = (uint8_t *) (message + 1);
+    message->external = NULL;
+    message->external_length = 0;
+    message->release_callback = NULL;
+    message->release_context = NULL;
+    message->compressed = NULL;
+    return message;
+}
+
+Message *Message_retain(Message *message) {
+    if (message) {
+        ++message->reference_count;
+    }
+    return message;
+}
+
+void Message_release(Message *message) {
+    if (!message) {
+        return;
+    }
+
+    if (--message->reference_count == 0) {
+        if (message->release_callback) {
+            message->release_callback(message, message->release_context);
+        }
+        Message_release(message->compressed);
+        free(message);
+    }
+}
+
+int Message_get_iovec(const Message *message, size_t offset, struct iovec iov[2]) {
+    size_t inline_length = message->length - message->external_length;
+    int count = 0;
+
+    if (offset < inline_length) {
+        iov[count].iov_base = message->data + offset;
+        iov[count].iov_len = inline_length - offset;
+        ++count;
+        offset = inline_length;
+    }
+    if (message->external_length > 0) {
+        iov[count].iov_base = (void *) (message->external + (offset - inline_length));
+        iov[count].iov_len = message->length - offset;
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,159 @@
+#include "core/MessageHistory.h"
+
+#include <stdlib.h>
+
+struct MessageHistory {
+    Message **slots;
+    size_t capacity;
+    uint64_t first_sequence; // oldest retained
+    uint64_t next_sequence;  // one past the newest
+    uint32_t *unacked;       // holders yet to acknowledge each slot, NULL unless tracking
+    uint32_t holders;
+    size_t retain;
+};
+
+MessageHistory *MessageHistory_create(size_t capacity, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (capacity == 0) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    MessageHistory *history = calloc(1, sizeof(MessageHistory));
+    if (!history) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    history->slots = calloc(capacity, sizeof(Message *));
+    if (!history->slots) {
+        free(history);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    history->capacity = capacity;
+    history->first_sequence = 0;
+    history->next_sequence = 0;
+    return history;
+}
+
+void MessageHistory_destroy(MessageHistory *history) {
+    if (!history) {
+        return;
+    }
+
+    for (size_t i = 0; i < history->capacity; ++i) {
+        Message_release(history->slots[i]);
+    }
+    free(history->unacked);
+    free(history->slots);
+    free(history);
+}
+
+int MessageHistory_track_acks(MessageHistory *history, size_t retain) {
+    if (!history->unacked && !(history->unacked = calloc(history->capacity, sizeof(uint32_t)))) {
+        return -1;
+    }
+    history->retain = retain > 0 ? retain : 1;
+    return 0;
+}
+
+// releases the oldest messages every holder has acknowledged, beyond the newest `retain`
+void MessageHistory_trim(MessageHistory *history) {
+    while (history->next_sequence - history->first_sequence > history->retain) {
+        size_t index = (size_t) (history->first_sequence % history->capacity);
+        if (history->unacked[index] > 0) {
+            return;
+        }
+        Message_release(history->slots[index]);
+        history->slots[index] = NULL;
+        ++history->first_sequence;
+    }
+}
+
+int MessageHistory_append(MessageHistory *history, Message *message) {
+    if (history->next_sequence == history->first_sequence) {
+        // empty ring starts wherever the caller's sequence numbers start
+        history->first_sequence = message->sequence;
+        history->next_sequence = message->sequence;
+    }
+
+    size_t index = (size_t) (message->sequence % history->capacity);
+    int is_lost = 0;
+    if (history->next_sequence - history->first_sequence == history->capacity) {
+        is_lost = history->unacked && history->unacked[index] > 0;
+        ++history->first_sequence;
+    }
+
+    Message_release(history->slots[index]);
+    history->slots[index] = Message_retain(message);
+    history->next_sequence = message->sequence + 1;
+    if (history->unacked) {
+        history->unacked[index] = history->holders;
+        MessageHistory_trim(history);
+    }
+    return is_lost;
+}
+
+void MessageHistory_hold(MessageHistory *history, uint64_t acked) {
+    if (!history->unacked) {
+        return;
+    }
+    ++history->holders;
+    uint64_t sequence = acked + 1 > history->first_sequence ? acked + 1 : history->first_sequence;
+    for (; sequence < history->next_sequence; ++sequence) {
+        ++history->unacked[sequence % history->capacity];
+    }
+}
+
+void MessageHistory_acknowledge(MessageHistory *history, uint64_t acked, uint64_t sequence) {
+    if (!history->unacked) {
+        return;
+    }
+    // evicted messages no longer count anyone, newer ones are not acknowledged yet
+    uint64_t from = acked + 1 > history->first_sequence ? acked + 1 : history->first_sequence;
+    uint64_t end = sequence + 1 < history->next_sequence ? sequence + 1 : history->next_sequence;
+    for (; from < end; ++from) {
+        --history->unacked[from % history->capacity];
+    }
+    MessageHistory_trim(history);
+}
+
+void MessageHistory_release(MessageHistory *history, uint64_t acked) {
+    if (!history->unacked || history->holders == 0) {
+        return;
+    }
+    --history->holders;
+    if (history->next_sequence > 0) {
+        MessageHistory_acknowledge(history, acked, history->next_sequence - 1);
+    }
+}
+
+Message *MessageHistory_get(const MessageHistory *history, uint64_t sequence) {
+    if (sequence < history->first_sequence || sequence >= history->next_sequence) {
+        return NULL;
+    }
+    return history->slots[sequence % history->capacity];
+}
+
+uint64_t MessageHistory_first_sequence(const MessageHistory *history) {
+    return history->first_sequence;
+}
+
+uint64_t MessageHistory_next_sequence(const MessageHistory *history) {
+    return history->next_sequence;
+}
+
+size_t MessageHistory_count(const MessageHistory *history) {
+    return (size_t) (history->next_sequence - history->first_sequence);
+}
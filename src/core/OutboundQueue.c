@@ -0,0 +1,209 @@
+#include "core/OutboundQueue.h"
+
+#include <stdlib.h>
+
+typedef struct QueueEntry QueueEntry;
+
+struct QueueEntry {
+    Message *message;
+    QueueEntry *next;
+    QueueEntry *next_keyed; // bucket chain of keyed entries not started yet
+};
+
+enum {
+    KEYED_BUCKETS = 256
+};
+
+typedef struct {
+    QueueEntry *head;
+    QueueEntry *tail;
+    size_t deficit; // bytes the lane may still send this round
+} Lane;
+
+// bytes per round; control may take 4/6 of the link while all lanes are busy,
+// chat and streams split the rest evenly
+static const size_t lane_quantum[LANE_COUNT] = {
+    [LANE_CONTROL] = 64 * 1024,
+    [LANE_MESSAGE] = 16 * 1024,
+    [LANE_STREAM] = 16 * 1024
+};
+
+struct OutboundQueue {
+    Lane lanes[LANE_COUNT];
+    int current_lane; // lane of the frame being written, -1 between frames
+    size_t offset;    // bytes of the current frame already written
+    size_t bytes;     // unwritten bytes over all lanes
+    QueueEntry **keyed; // by message key % KEYED_BUCKETS, NULL until the first keyed push
+};
+
+OutboundQueue *OutboundQueue_create(int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    OutboundQueue *queue = calloc(1, sizeof(OutboundQueue));
+    if (!queue) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    queue->current_lane = -1;
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        queue->lanes[lane].deficit = lane_quantum[lane];
+    }
+    return queue;
+}
+
+void OutboundQueue_destroy(OutboundQueue *queue) {
+    if (!queue) {
+        return;
+    }
+
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        QueueEntry *entry = queue->lanes[lane].head;
+        while (entry) {
+            QueueEntry *next = entry->next;
+            Message_release(entry->message);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(queue->keyed);
+    free(queue);
+}
+
+// queued entry holding the key, NULL if there is none or it is being written
+QueueEntry *OutboundQueue_find_keyed(const OutboundQueue *queue, uint32_t key) {
+    if (!queue->keyed) {
+        return NULL;
+    }
+    QueueEntry *entry = queue->keyed[key % KEYED_BUCKETS];
+    while (entry && entry->message->key != key) {
+        entry = entry->next_keyed;
+    }
+    return entry;
+}
+
+// the entry is about to be written, a newer value must not change it any more
+void OutboundQueue_unlink_keyed(OutboundQueue *queue, QueueEntry *entry) {
+    if (entry->message->key == 0 || !queue->keyed) {
+        return;
+    }
+    QueueEntry **link = &queue->keyed[entry->message->key % KEYED_BUCKETS];
+    while (*link && *link != entry) {
+        link = &(*link)->next_keyed;
+    }
+    if (*link) {
+        *link = entry->next_keyed;
+    }
+}
+
+int OutboundQueue_push(OutboundQueue *queue, OutboundLane lane, Message *message) {
+    if (message->key != 0) {
+        QueueEntry *queued = OutboundQueue_find_keyed(queue, message->key);
+        if (queued) {
+            // conflated: the old value is never sent, the new one keeps its place
+            queue->bytes = queue->bytes - queued->message->length + message->length;
+            Message_release(queued->message);
+            queued->message = Message_retain(message);
+            return 1;
+        }
+        if (!queue->keyed && !(queue->keyed = calloc(KEYED_BUCKETS, sizeof(QueueEntry *)))) {
+            return -1;
+        }
+    }
+
+    QueueEntry *entry = malloc(sizeof(QueueEntry));
+    if (!entry) {
+        return -1;
+    }
+
+    entry->message = Message_retain(message);
+    entry->next = NULL;
+    entry->next_keyed = NULL;
+    if (message->key != 0) {
+        entry->next_keyed = queue->keyed[message->key % KEYED_BUCKETS];
+        queue->keyed[message->key % KEYED_BUCKETS] = entry;
+    }
+    if (queue->lanes[lane].tail) {
+        queue->lanes[lane].tail->next = entry;
+    } else {
+        queue->lanes[lane].head = entry;
+    }
+    queue->lanes[lane].tail = entry;
+    queue->bytes += message->length;
+    return 0;
+}
+
+// picks the first lane, in priority order, whose credit covers its next frame;
+// when none does a new round starts. Idle lanes keep at most one quantum so a
+// control frame arriving after a quiet spell goes out at the next frame boundary.
+int OutboundQueue_select_lane(OutboundQueue *queue) {
+    for (;;) {
+        for (int lane = 0; lane < LANE_COUNT; ++lane) {
+            Lane *candidate = &queue->lanes[lane];
+            if (candidate->head && candidate->deficit >= candidate->head->message->length) {
+                candidate->deficit -= candidate->head->message->length;
+                return lane;
+            }
+        }
+
+        for (int lane = 0; lane < LANE_COUNT; ++lane) {
+            Lane *candidate = &queue->lanes[lane];
+            candidate->deficit += lane_quantum[lane];
+            if (!candidate->head && candidate->deficit > lane_quantum[lane]) {
+                candidate->deficit = lane_quantum[lane];
+            }
+        }
+    }
+}
+
+Message *OutboundQueue_peek(OutboundQueue *queue, size_t *offset) {
+    if (queue->current_lane < 0) {
+        if (queue->bytes == 0) {
+            return NULL;
+        }
+        queue->current_lane = OutboundQueue_select_lane(queue);
+        queue->offset = 0;
+        OutboundQueue_unlink_keyed(queue, queue->lanes[queue->current_lane].head);
+    }
+
+    if (offset) {
+        *offset = queue->offset;
+    }
+    return queue->lanes[queue->current_lane].head->message;
+}
+
+void OutboundQueue_advance(OutboundQueue *queue, size_t bytes) {
+    if (queue->current_lane < 0) {
+        return;
+    }
+
+    Lane *lane = &queue->lanes[queue->current_lane];
+    QueueEntry *entry = lane->head;
+    queue->offset += bytes;
+    queue->bytes -= bytes;
+    if (queue->offset < entry->message->length) {
+        return;
+    }
+
+    lane->head = entry->next;
+    if (!lane->head) {
+        lane->tail = NULL;
+    }
+    queue->current_lane = -1;
+    queue->offset = 0;
+
+    Message_release(entry->message);
+    free(entry);
+}
+
+size_t OutboundQueue_bytes(const OutboundQueue *queue) {
+    return queue->bytes;
+}
+
+int OutboundQueue_is_empty(const OutboundQueue *queue) {
+    return queue->bytes == 0;
+}
@@ -1,35 +1,156 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include "core/Console.h"
+#include "core/LastValueCache.h"
+#include "core/Message.h"
+#include "core/MessageHistory.h"
+#include "core/OutboundQueue.h"
 #include "core/ProcessingServer.h"
+#include "core/Protocol.h"
+#include "core/Trace.h"
+#include "utils/clock.h"
+#include "utils/crypto.h"
+#include "utils/lz.h"
 #include "utils/safe_io.h"
 
 enum {
     LISTEN_BACKLOG = 10,
+    HISTORY_CAPACITY = 1024, // broadcasts kept for clients resuming after a reconnect
+    LINGER_MS = 30000, // reliable delivery keeps waiting this long for a disconnected subscriber
+    MAX_EVENTS = 64,
+    BUSY_POLL_SOCKET_USECS = 50, // SO_BUSY_POLL budget for blocking socket calls
+    OUTBOUND_QUEUE_LIMIT = 8 * 1024 * 1024, // a client further behind is dropped (it can resume)
+    MAX_STREAMS_PER_CLIENT = 4,
+    MAX_STREAM_NAME_LENGTH = 255,
+    HEARTBEAT_INTERVAL_MS = 1000, // multicast receivers notice a lost tail within this
+    CONSOLE_RENDER_INTERVAL_MS = 100, // busy polling redraws the console at most this often while spinning
+    MAX_CACHED_KEYS = 65536, // bounds last-value cache memory and every client's conflated backlog
+    LOAD_HOLD_MS = 500, // lag must stay low this long before a load level is left
+    THROTTLE_INTERVAL_MS = 50,
+    SHED_BACKLOG = 256 * 1024, // while shedding, clients with more queued skip chat broadcasts
+    FEED_BATCH_BYTES = 256 * 1024 // snapshots and resumes are queued this much at a time as the client drains them
+};
+
+// epoll data of the descriptors that are not clients
+static char listen_event_tag;
+static char stdin_event_tag;
+
+typedef struct ZerocopySend ZerocopySend;
+
+// MSG_ZEROCOPY send whose pages the kernel may still reference
+struct ZerocopySend {
+    uint32_t id; // per-socket counter the kernel reports completions against
+    size_t bytes;
+    Message *message;
+    ZerocopySend *next;
 };
 
 typedef struct ClientNode ClientNode;
+typedef struct InboundStream InboundStream;
+
+// stream a client is sending through the relay
+struct InboundStream {
+    uint32_t sender_stream_id;
+    uint32_t relay_stream_id;
+    ClientNode *owner; // NULL once the sender is gone
+    char name[MAX_STREAM_NAME_LENGTH + 1];
+    uint64_t window;          // bytes the sender may still send
+    uint64_t pending_credit;  // sent to every receiver, not granted back yet
+    size_t chunks_in_flight;  // relayed chunks still referenced by some queue
+    int is_open;
+    int is_aborted;           // sender vanished, receivers still have to be told
+    InboundStream *next;
+};
 
 struct ClientNode {
     int file_descriptor;
+    uint32_t connection_id; // names the connection in capture traces
     struct sockaddr_in address;
+    FrameReader *reader;
+    int is_ready; // handshake finished, client receives broadcasts
+    uint8_t receive_key[CRYPTO_KEY_SIZE];
+    uint64_t next_receive_nonce;
+    int is_zerocopy; // SO_ZEROCOPY accepted by the kernel
+    uint32_t zerocopy_next_id;
+    ZerocopySend *zerocopy_head; // oldest first
+    ZerocopySend *zerocopy_tail;
+    OutboundQueue *outbound;
+    int is_write_armed; // EPOLLOUT registered because the socket buffer filled up
+    int stream_count;
+    int is_multicast; // subscribed: sequenced broadcasts reach it through the group
+    uint8_t codec;    // compression picked in the handshake, COMPRESSION_NONE if any
+    uint64_t throttled_until_ms; // 0 unless overload protection paused reading
+    int is_holding;            // counted as a holder of the history, reliable delivery only
+    uint64_t acked_sequence;   // everything up to this was delivered
+    uint32_t snapshot_next;    // next last-value cache key to send, 0 once the snapshot is done
+    uint64_t resume_next;      // next retained broadcast to replay, 0 once caught up
+    uint64_t resume_end;       // replay stops here for a multicast subscriber, the group carries the rest
     ClientNode *next;
 };
+// a detached client keeps its node (with file_descriptor = -1) until the current
+// batch of events is handled, events later in the batch may still point at it
+
+// what a disconnected reliable subscriber acknowledged, held until it expires;
+// oldest first, so expiring only ever looks at the head
+typedef struct LingeringHold {
+    uint64_t acked_sequence;
+    uint64_t expires_ms;
+    struct LingeringHold *next;
+} LingeringHold;
 
 struct ProcessingServer {
     int listen_file_descriptor;
     ClientNode *clients;
+    ClientNode *detached_clients;
     int client_count;
-    fd_set master_file_descriptor_set;
-    int max_file_descriptor;
+    int epoll_file_descriptor;
     int port;
+    int is_encrypted;
+    CipherState group_cipher; // every broadcast is sealed once with this key
+    uint64_t epoch; // random per run, tells resuming clients whether sequences still apply
+    uint64_t next_sequence;
+    MessageHistory *history;
+    int is_reliable;
+    LingeringHold *lingering_head;
+    LingeringHold *lingering_tail;
+    LastValueCache *last_values; // newest update per key
+    size_t zerocopy_threshold; // 0 disables MSG_ZEROCOPY
+    int is_compressing;
+    size_t compression_threshold; // shorter texts are not worth compressing
+    int is_busy_poll;
+    int busy_poll_cpu; // -1 keeps the inherited affinity
+    uint64_t busy_poll_spin_ns;
+    InboundStream *streams; // closed streams stay until their last chunk is released
+    uint32_t next_stream_id;
+    uint32_t next_connection_id;
+    TraceWriter *capture; // NULL unless capturing inbound traffic
+    int multicast_file_descriptor; // -1 unless publishing to a multicast group
+    struct sockaddr_in multicast_address;
+    int multicast_client_count;
+    uint64_t next_heartbeat_ms;
+    Console *console; // NULL when embedded, set while ProcessingServer_run owns the terminal
+    int is_console_stale; // lines were logged since the console was last drawn
+    int is_running;
+    uint64_t overload_threshold_ns; // 0 disables overload protection
+    ProcessingServerLoad load_level;
+    uint64_t loop_lag_ns;           // smoothed iteration duration
+    uint64_t load_calm_since_ms;    // lag low enough to step down since, 0 if not
+    int throttled_count;
+    ProcessingServerCallbacks callbacks;
+    ProcessingServerStats stats;
 };
 
 int ProcessingServer_create_listening_socket(int port, int *error_flag) {
@@ -102,269 +223,1832 @@ ProcessingServer *ProcessingServer_create(int port, int *error_flag) {
     server->port = port;
     server->clients = NULL;
     server->client_count = 0;
+    server->next_sequence = 1;
+
+    int setup_error = 0;
+    do {
+        crypto_random_bytes(&server->epoch, sizeof(server->epoch), &setup_error);
+    } while (!setup_error && server->epoch == 0); // 0 means "never connected" in HELLO
+
+    if (!setup_error) {
+        server->history = MessageHistory_create(HISTORY_CAPACITY, &setup_error);
+    }
+    if (!setup_error) {
+        server->last_values = LastValueCache_create(MAX_CACHED_KEYS, &setup_error);
+    }
+    if (setup_error) {
+        MessageHistory_destroy(server->history);
+        free(server);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    server->busy_poll_cpu = -1;
+    server->multicast_file_descriptor = -1;
     server->listen_file_descriptor = ProcessingServer_create_listening_socket(port, error_flag);
 
     if (server->listen_file_descriptor < 0) {
+        MessageHistory_destroy(server->history);
+        LastValueCache_destroy(server->last_values);
+        free(server);
         if (error_flag) {
             *error_flag = 1;
         }
         return NULL;
     }
 
-    FD_ZERO(&server->master_file_descriptor_set);
-    FD_SET(server->listen_file_descriptor, &server->master_file_descriptor_set);
-    server->max_file_descriptor = server->listen_file_descriptor;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_event_tag;
+    server->epoll_file_descriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epoll_file_descriptor < 0
+        || epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_ADD, server->listen_file_descriptor, &event) < 0) {
+        if (server->epoll_file_descriptor >= 0) {
+            close(server->epoll_file_descriptor);
+        }
+        close(server->listen_file_descriptor);
+        MessageHistory_destroy(server->history);
+        LastValueCache_destroy(server->last_values);
+        free(server);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
 
     return server;
 }
 
-void ProcessingServer_attach_client(ProcessingServer *server, int file_descriptor, struct sockaddr_in *address) {
-    ClientNode *node = malloc(sizeof(ClientNode));
-    node->file_descriptor = file_descriptor;
-    node->address = *address;
-    node->next = server->clients;
-    server->clients = node;
-    ++server->client_count;
+void ProcessingServer_enable_encryption(ProcessingServer *server, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
 
-    FD_SET(file_descriptor, &server->master_file_descriptor_set);
-    if (file_descriptor > server->max_file_descriptor) {
-        server->max_file_descriptor = file_descriptor;
+    int random_error = 0;
+    crypto_random_bytes(server->group_cipher.key, sizeof(server->group_cipher.key), &random_error);
+    if (random_error) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
     }
+    server->group_cipher.nonce_counter = 0;
+    server->is_encrypted = 1;
 }
 
-void Processing_server_detach_client(ProcessingServer *server, int file_descriptor) {
-    ClientNode **current = &server->clients;
-    while (*current) {
-        if ((*current)->file_descriptor == file_descriptor) {
-            ClientNode *tmp = *current;
-            *current = tmp->next;
-            close(tmp->file_descriptor);
-            free(tmp);
-            --server->client_count;
-            break;
+void ProcessingServer_enable_reliable_delivery(ProcessingServer *server, size_t capacity, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server || capacity < HISTORY_CAPACITY || capacity > UINT32_MAX || server->client_count > 0
+        || MessageHistory_count(server->history) > 0) {
+        if (error_flag) {
+            *error_flag = 1;
         }
-        current = &(*current)->next;
+        return;
+    }
+
+    int create_error = 0;
+    MessageHistory *history = MessageHistory_create(capacity, &create_error);
+    if (create_error || MessageHistory_track_acks(history, HISTORY_CAPACITY) < 0) {
+        MessageHistory_destroy(history);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
     }
 
-    FD_CLR(file_descriptor, &server->master_file_descriptor_set);
+    MessageHistory_destroy(server->history);
+    server->history = history;
+    server->is_reliable = 1;
+}
 
-    if (file_descriptor == server->max_file_descriptor) {
-        int new_max = server->listen_file_descriptor;
-        for (ClientNode *current_ = server->clients; current_; current_ = current_->next) {
-            if (current_->file_descriptor > new_max) {
-                new_max = current_->file_descriptor;
-            }
+void ProcessingServer_enable_overload_protection(ProcessingServer *server, unsigned int lag_threshold_us,
+                                                 int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server || lag_threshold_us == 0) {
+        if (error_flag) {
+            *error_flag = 1;
         }
-        server->max_file_descriptor = new_max;
+        return;
     }
+    server->overload_threshold_ns = (uint64_t) lag_threshold_us * 1000;
 }
 
-int ProcessingServer_accept_connection(int listen_file_descriptor, struct sockaddr_in *client_address, int *error_flag) {
+void ProcessingServer_set_zerocopy_threshold(ProcessingServer *server, size_t threshold) {
+    if (server) {
+        server->zerocopy_threshold = threshold;
+    }
+}
+
+void ProcessingServer_enable_compression(ProcessingServer *server, size_t threshold) {
+    if (server) {
+        server->is_compressing = 1;
+        server->compression_threshold = threshold;
+    }
+}
+
+// low-latency socket options; failures only cost latency, so they are ignored
+void ProcessingServer_tune_socket(const ProcessingServer *server, int file_descriptor) {
+    if (!server->is_busy_poll) {
+        return;
+    }
+
+    int opt = 1;
+    int usecs = BUSY_POLL_SOCKET_USECS;
+    setsockopt(file_descriptor, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    setsockopt(file_descriptor, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+#ifdef SO_PREFER_BUSY_POLL
+    setsockopt(file_descriptor, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt));
+#endif
+}
+
+void ProcessingServer_enable_busy_poll(ProcessingServer *server, int cpu, unsigned int spin_us, int *error_flag) {
     if (error_flag) {
         *error_flag = 0;
     }
-    
-    socklen_t length = sizeof(*client_address);
-    while (1) {
-        int file_descriptor = accept(listen_file_descriptor, (struct sockaddr *) client_address, &length);
-        if (file_descriptor < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            if (error_flag) {
-                *error_flag = 1;
-            }
+
+    if (!server || cpu >= CPU_SETSIZE) {
+        if (error_flag) {
+            *error_flag = 1;
         }
-        return file_descriptor;
+        return;
     }
+
+    server->is_busy_poll = 1;
+    server->busy_poll_cpu = cpu;
+    server->busy_poll_spin_ns = (uint64_t) spin_us * 1000;
+    ProcessingServer_tune_socket(server, server->listen_file_descriptor);
 }
 
-void ProcessingServer_broadcast(ProcessingServer *server, const char *message, size_t message_length) {
-    ClientNode *current = server->clients;
-    ClientNode *next;
+void ProcessingServer_enable_capture(ProcessingServer *server, const char *path, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
 
-    while (current) {
-        next = current->next;
-        
-        size_t sent = 0;
-        while (sent < message_length) {
-            ssize_t current_sent = send(current->file_descriptor, message + sent, message_length - sent, 0);
-            if (current_sent == 0) {
-                Processing_server_detach_client(server, current->file_descriptor);
-                break;
-            }
-            if (current_sent < 0) {
-                if (errno == EPIPE || errno == ECONNRESET || errno == ECONNABORTED) {
-                    close(current->file_descriptor);
-                    Processing_server_detach_client(server, current->file_descriptor);
-                } else {
-                    perror("send");
-                }
-                break;
-            }
-            sent += current_sent;
+    if (!server || !path || server->capture) {
+        if (error_flag) {
+            *error_flag = 1;
         }
-        current = next;
+        return;
     }
+
+    server->capture = TraceWriter_create(path, error_flag);
 }
 
-void ProcessingServer_run(ProcessingServer *server, int *error_flag) {
+void ProcessingServer_enable_multicast(ProcessingServer *server, const char *group_ip, int port,
+                                       const char *interface_ip, int *error_flag) {
     if (error_flag) {
         *error_flag = 0;
     }
 
-    int max_file_descriptor = server->listen_file_descriptor;
-    if (STDIN_FILENO > max_file_descriptor) {
-        max_file_descriptor = STDIN_FILENO;
+    struct in_addr interface_address = {htonl(INADDR_ANY)};
+    int is_valid = server && group_ip && port > 0 && port <= 65535 && server->multicast_file_descriptor < 0;
+    if (is_valid) {
+        memset(&server->multicast_address, 0, sizeof(server->multicast_address));
+        server->multicast_address.sin_family = AF_INET;
+        server->multicast_address.sin_port = htons((uint16_t) port);
+        is_valid = inet_pton(AF_INET, group_ip, &server->multicast_address.sin_addr) == 1
+                   && IN_MULTICAST(ntohl(server->multicast_address.sin_addr.s_addr))
+                   && (!interface_ip || inet_pton(AF_INET, interface_ip, &interface_address) == 1);
+    }
+    if (!is_valid) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
     }
 
-    int create_console_error = 0;
-    Console *console = Console_create(&create_console_error);
-    if (create_console_error) {
+    int file_descriptor = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unsigned char ttl = 1;   // LAN only
+    unsigned char loop = 1;  // receivers on the relay host, e.g. loopback tests
+    if (file_descriptor < 0
+        || setsockopt(file_descriptor, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0
+        || setsockopt(file_descriptor, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0
+        || setsockopt(file_descriptor, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) < 0) {
+        perror("multicast socket");
+        if (file_descriptor >= 0) {
+            close(file_descriptor);
+        }
         if (error_flag) {
             *error_flag = 1;
         }
         return;
     }
+    server->multicast_file_descriptor = file_descriptor;
+}
 
-    clear_screen();
-    hide_cursor();
-    for (int i = 0; i < MESSAGES_DISPLAYED; ++i) {
-        Console_add_message(console, "");
+// one datagram reaches every subscriber; a lost one is repaired on NACK
+int ProcessingServer_send_multicast(ProcessingServer *server, Message *message) {
+    if (server->multicast_file_descriptor < 0 || message->length > MULTICAST_MAX_DATAGRAM) {
+        return 0;
     }
-    Console_render(console);
 
-    char buffer[BUFSIZ];
-    int is_running = 1;
-    while (is_running) {
-        fd_set read_file_descriptor_set;
-        FD_ZERO(&read_file_descriptor_set);
-        
-        FD_SET(STDIN_FILENO, &read_file_descriptor_set);
-        
-        FD_SET(server->listen_file_descriptor, &read_file_descriptor_set);
-        
-        ClientNode *client = server->clients;
-        while (client) {
-            FD_SET(client->file_descriptor, &read_file_descriptor_set);
-            if (client->file_descriptor > max_file_descriptor) {
-                max_file_descriptor = client->file_descriptor;
-            }
-            client = client->next;
+    struct iovec iov[2];
+    struct msghdr header = {0};
+    header.msg_name = &server->multicast_address;
+    header.msg_namelen = sizeof(server->multicast_address);
+    header.msg_iov = iov;
+    header.msg_iovlen = (size_t) Message_get_iovec(message, 0, iov);
+    ssize_t sent = sendmsg(server->multicast_file_descriptor, &header, 0);
+    if (sent == (ssize_t) message->length) {
+        ++server->stats.multicast_datagrams;
+    }
+    return 1;
+}
+
+void ProcessingServer_capture(ProcessingServer *server, const ClientNode *client, uint8_t event, uint8_t frame_type,
+                              const void *payload, size_t length) {
+    if (!server->capture) {
+        return;
+    }
+
+    TraceRecord record = {clock_monotonic_ns(), client->connection_id, event, frame_type, (uint32_t) length};
+    int write_error = 0;
+    TraceWriter_write(server->capture, &record, payload, &write_error);
+    if (write_error) {
+        // a full disk must not take the relay down with it
+        fprintf(stderr, "Capture write failed, capture stopped\n");
+        TraceWriter_destroy(server->capture);
+        server->capture = NULL;
+    }
+}
+
+void ProcessingServer_set_callbacks(ProcessingServer *server, const ProcessingServerCallbacks *callbacks) {
+    if (server) {
+        memset(&server->callbacks, 0, sizeof(server->callbacks));
+        if (callbacks) {
+            server->callbacks = *callbacks;
         }
+    }
+}
+
+int ProcessingServer_get_file_descriptor(const ProcessingServer *server) {
+    return server ? server->epoll_file_descriptor : -1;
+}
+
+// console line when run interactively, embedded servers stay quiet
+void ProcessingServer_log(ProcessingServer *server, const char *line) {
+    // drawn by ProcessingServer_run between batches, terminal writes stay out of the relay path
+    if (server->console) {
+        Console_add_message(server->console, line);
+        server->is_console_stale = 1;
+    }
+}
+
+void ProcessingServer_get_stats(const ProcessingServer *server, ProcessingServerStats *stats) {
+    if (server && stats) {
+        *stats = server->stats;
+    }
+}
+
+int ProcessingServer_attach_client(ProcessingServer *server, int file_descriptor, struct sockaddr_in *address) {
+    ClientNode *node = calloc(1, sizeof(ClientNode));
+    if (!node) {
+        close(file_descriptor);
+        return -1;
+    }
+
+    int reader_error = 0;
+    node->reader = FrameReader_create(&reader_error);
+    if (!reader_error) {
+        node->outbound = OutboundQueue_create(&reader_error);
+    }
+    if (reader_error) {
+        FrameReader_destroy(node->reader);
+        free(node);
+        close(file_descriptor);
+        return -1;
+    }
+
+    node->file_descriptor = file_descriptor;
+    node->address = *address;
+    node->is_ready = 0;
+
+    int opt = 1;
+    if (server->zerocopy_threshold > 0
+        && setsockopt(file_descriptor, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == 0) {
+        node->is_zerocopy = 1;
+    }
+    ProcessingServer_tune_socket(server, file_descriptor);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = node;
+    if (epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_ADD, file_descriptor, &event) < 0) {
+        FrameReader_destroy(node->reader);
+        OutboundQueue_destroy(node->outbound);
+        free(node);
+        close(file_descriptor);
+        return -1;
+    }
+
+    node->connection_id = server->next_connection_id++;
+    node->next = server->clients;
+    server->clients = node;
+    ++server->client_count;
+    ProcessingServer_capture(server, node, TRACE_CONNECT, 0, NULL, 0);
+    return 0;
+}
+
+// drains MSG_ZEROCOPY completions from the socket error queue
+void ProcessingServer_reap_zerocopy(ProcessingServer *server, ClientNode *client) {
+    while (client->zerocopy_head) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr message_header;
+        memset(&message_header, 0, sizeof(message_header));
+        message_header.msg_control = control;
+        message_header.msg_controllen = sizeof(control);
 
-        int ready = select(max_file_descriptor + 1, &read_file_descriptor_set, NULL, NULL, NULL);
-        if (ready < 0) {
+        if (recvmsg(client->file_descriptor, &message_header, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("select");
-            break;
+            return; // EAGAIN: nothing completed yet
         }
 
-        if (FD_ISSET(STDIN_FILENO, &read_file_descriptor_set)) {
-            if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
-                is_running = 0;
-                break;
+        struct cmsghdr *control_header = CMSG_FIRSTHDR(&message_header);
+        if (!control_header) {
+            continue;
+        }
+        struct sock_extended_err error;
+        memcpy(&error, CMSG_DATA(control_header), sizeof(error));
+        if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+        }
+
+        // ids [ee_info, ee_data] completed; the kernel may have copied them after all
+        int was_copied = (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+        uint32_t first = error.ee_info;
+        uint32_t span = error.ee_data - first;
+
+        ZerocopySend **link = &client->zerocopy_head;
+        ZerocopySend *previous = NULL;
+        while (*link) {
+            ZerocopySend *pending = *link;
+            if (pending->id - first > span) {
+                previous = pending;
+                link = &pending->next;
+                continue;
             }
-            
-            if (strcmp(buffer, "exit()\n") == 0) {
-                is_running = 0;
-                break;
+
+            if (was_copied) {
+                server->stats.bytes_zerocopy_copied += pending->bytes;
+            } else {
+                server->stats.bytes_zerocopy += pending->bytes;
             }
-            
-            char message_buffer[BUFSIZ];
-            snprintf(message_buffer, sizeof(message_buffer), "[SERVER]: %.*s", (int) strlen(buffer), buffer);
-            ProcessingServer_broadcast(server, message_buffer, strlen(message_buffer));
+            --server->stats.zerocopy_in_flight;
 
-            Console_add_message(console, buffer);
-            Console_render(console);
+            *link = pending->next;
+            if (client->zerocopy_tail == pending) {
+                client->zerocopy_tail = previous;
+            }
+            Message_release(pending->message);
+            free(pending);
         }
+    }
+}
 
-        if (FD_ISSET(server->listen_file_descriptor, &read_file_descriptor_set)) {
-            struct sockaddr_in client_address;
-            int accept_error = 0;
-            int client_fd = ProcessingServer_accept_connection(
-                server->listen_file_descriptor, &client_address, &accept_error);
-
-            if (client_fd >= 0) {
-                ProcessingServer_attach_client(server, client_fd, &client_address);
-
-                char ip[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET, &client_address.sin_addr, ip, sizeof(ip));
-                unsigned short port = ntohs(client_address.sin_port);
-                snprintf(buffer, sizeof(buffer), "Client connected: %s:%d", ip, port);
-                Console_add_message(console, buffer);
-                Console_render(console);
-                
-                if (client_fd > max_file_descriptor) {
-                    max_file_descriptor = client_fd;
-                }
-            }
+// releases the buffers of sends that will never complete
+void ProcessingServer_drop_zerocopy(ProcessingServer *server, ClientNode *client) {
+    while (client->zerocopy_head) {
+        ZerocopySend *pending = client->zerocopy_head;
+        client->zerocopy_head = pending->next;
+        --server->stats.zerocopy_in_flight;
+        Message_release(pending->message);
+        free(pending);
+    }
+    client->zerocopy_tail = NULL;
+}
+
+// closes the client's socket; zero-copy sends still incomplete are cut off with an
+// abortive close, which discards what the kernel queued instead of sending it from
+// message pages that are about to be released
+void ProcessingServer_close_socket(ProcessingServer *server, ClientNode *client) {
+    ProcessingServer_reap_zerocopy(server, client);
+    if (client->zerocopy_head) {
+        struct linger abort_close = {1, 0};
+        setsockopt(client->file_descriptor, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+    }
+    close(client->file_descriptor);
+    client->file_descriptor = -1;
+}
+
+// keeps waiting for what a disconnected subscriber did not acknowledge, it may resume soon
+void ProcessingServer_linger(ProcessingServer *server, uint64_t acked_sequence) {
+    LingeringHold *hold = malloc(sizeof(LingeringHold));
+    if (!hold) {
+        MessageHistory_release(server->history, acked_sequence);
+        return;
+    }
+
+    hold->acked_sequence = acked_sequence;
+    hold->expires_ms = clock_monotonic_ms() + LINGER_MS;
+    hold->next = NULL;
+    if (server->lingering_tail) {
+        server->lingering_tail->next = hold;
+    } else {
+        server->lingering_head = hold;
+    }
+    server->lingering_tail = hold;
+    ++server->stats.lingering_subscribers;
+}
+
+void ProcessingServer_expire_lingering(ProcessingServer *server, int is_all) {
+    uint64_t now = clock_monotonic_ms();
+    while (server->lingering_head && (is_all || now >= server->lingering_head->expires_ms)) {
+        LingeringHold *hold = server->lingering_head;
+        server->lingering_head = hold->next;
+        MessageHistory_release(server->history, hold->acked_sequence);
+        free(hold);
+        --server->stats.lingering_subscribers;
+    }
+    if (!server->lingering_head) {
+        server->lingering_tail = NULL;
+    }
+}
+
+// a subscriber resuming right where a lingering one stopped takes over its hold; holds
+// with the same acknowledged sequence wait for the same messages, so any of them will do
+void ProcessingServer_reclaim_lingering(ProcessingServer *server, uint64_t acked_sequence) {
+    LingeringHold *previous = NULL;
+    for (LingeringHold *hold = server->lingering_head; hold; previous = hold, hold = hold->next) {
+        if (hold->acked_sequence != acked_sequence) {
+            continue;
+        }
+        if (previous) {
+            previous->next = hold->next;
+        } else {
+            server->lingering_head = hold->next;
         }
+        if (server->lingering_tail == hold) {
+            server->lingering_tail = previous;
+        }
+        MessageHistory_release(server->history, hold->acked_sequence);
+        free(hold);
+        --server->stats.lingering_subscribers;
+        return;
+    }
+}
 
-        client = server->clients;
-        while (client) {
-            ClientNode *next = client->next;
-            
-            if (FD_ISSET(client->file_descriptor, &read_file_descriptor_set)) {
-                int read_error = 0;
-                ssize_t bytes_read = safe_read(client->file_descriptor, buffer, sizeof(buffer) - 1, &read_error);
-
-                if (bytes_read <= 0 || read_error) {
-                    char ip[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &client->address.sin_addr, ip, sizeof(ip));
-                    unsigned short port = ntohs(client->address.sin_port);
-                    snprintf(buffer, sizeof(buffer), "Client %s:%d disconnected", ip, port);
-                    Console_add_message(console, buffer);
-                    Console_render(console);
-                    
-                    Processing_server_detach_client(server, client->file_descriptor);
-                } else {
-                    buffer[bytes_read] = '\0';
-                    
-                    char ip[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &client->address.sin_addr, ip, sizeof(ip));
-                    unsigned short port = ntohs(client->address.sin_port);
-
-                    char message_buffer[BUFSIZ];
-                    size_t display_length = bytes_read;
-                    if (bytes_read >= MAX_MESSAGE_LENGTH) {
-                        display_length = MAX_MESSAGE_LENGTH;
-                    }
-                    
-                    snprintf(message_buffer, sizeof(message_buffer), "[%s:%d]: %.*s", ip, port, (int)display_length, buffer);
-                    Console_add_message(console, message_buffer);
-                    Console_render(console);
-
-                    ProcessingServer_broadcast(server, message_buffer, strlen(message_buffer));
+void Processing_server_detach_client(ProcessingServer *server, int file_descriptor) {
+    ClientNode **current = &server->clients;
+    while (*current) {
+        if ((*current)->file_descriptor == file_descriptor) {
+            ClientNode *tmp = *current;
+            *current = tmp->next;
+            ProcessingServer_capture(server, tmp, TRACE_DISCONNECT, 0, NULL, 0);
+            if (tmp->is_multicast) {
+                --server->multicast_client_count;
+            }
+            if (tmp->throttled_until_ms) {
+                --server->throttled_count;
+            }
+            if (tmp->is_holding) {
+                ProcessingServer_linger(server, tmp->acked_sequence);
+            }
+            for (InboundStream *stream = server->streams; stream; stream = stream->next) {
+                if (stream->owner == tmp) {
+                    stream->owner = NULL;
+                    stream->is_open = 0;
+                    stream->is_aborted = 1;
                 }
             }
-            
-            client = next;
+            epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_DEL, tmp->file_descriptor, NULL);
+            ProcessingServer_close_socket(server, tmp);
+            tmp->next = server->detached_clients;
+            server->detached_clients = tmp;
+            --server->client_count;
+            if (tmp->is_ready && server->callbacks.on_disconnect) {
+                server->callbacks.on_disconnect(server->callbacks.context, tmp->connection_id);
+            }
+            break;
         }
+        current = &(*current)->next;
     }
-
-    move_cursor(AT_EXIT_MESSAGE_ROW, 1);
-    reset_terminal();
-    show_cursor();
-    printf("Server stopped successfully.\n");
-    Console_destroy(console);
 }
 
-void ProcessingServer_destroy(ProcessingServer *server) {
-    ClientNode *current = server->clients;
-    while (current) {
-        ClientNode *next = current->next;
-        close(current->file_descriptor);
-        free(current);
-        current = next;
+void ProcessingServer_free_client(ProcessingServer *server, ClientNode *client) {
+    if (client->file_descriptor >= 0) {
+        ProcessingServer_close_socket(server, client);
     }
+    ProcessingServer_drop_zerocopy(server, client);
+    FrameReader_destroy(client->reader);
+    OutboundQueue_destroy(client->outbound);
+    memset(client->receive_key, 0, sizeof(client->receive_key));
+    free(client);
+}
 
-    if (server->listen_file_descriptor >= 0) {
-        close(server->listen_file_descriptor);
+void ProcessingServer_free_detached_clients(ProcessingServer *server) {
+    while (server->detached_clients) {
+        ClientNode *next = server->detached_clients->next;
+        ProcessingServer_free_client(server, server->detached_clients);
+        server->detached_clients = next;
     }
+}
 
+int ProcessingServer_accept_connection(int listen_file_descriptor, struct sockaddr_in *client_address, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+    
+    socklen_t length = sizeof(*client_address);
+    while (1) {
+        int file_descriptor = accept4(listen_file_descriptor, (struct sockaddr *) client_address, &length,
+                                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (file_descriptor < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (error_flag) {
+                *error_flag = 1;
+            }
+        }
+        return file_descriptor;
+    }
+}
+
+// keeps the message alive until the kernel reports the send complete; pending is
+// allocated before the send so a zero-copy send is never left untracked
+void ProcessingServer_track_zerocopy(ProcessingServer *server, ClientNode *client, ZerocopySend *pending,
+                                     Message *message, size_t bytes) {
+    pending->id = client->zerocopy_next_id++;
+    pending->bytes = bytes;
+    pending->message = Message_retain(message);
+    pending->next = NULL;
+    if (client->zerocopy_tail) {
+        client->zerocopy_tail->next = pending;
+    } else {
+        client->zerocopy_head = pending;
+    }
+    client->zerocopy_tail = pending;
+    ++server->stats.zerocopy_in_flight;
+}
+
+
+int ProcessingServer_watch_client(ProcessingServer *server, ClientNode *client, int is_reading, int is_writing) {
+    struct epoll_event event;
+    event.events = (is_reading ? EPOLLIN : 0) | (is_writing ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    return epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_MOD, client->file_descriptor, &event);
+}
+
+void ProcessingServer_arm_write(ProcessingServer *server, ClientNode *client, int is_armed) {
+    if (client->is_write_armed == is_armed) {
+        return;
+    }
+
+    if (ProcessingServer_watch_client(server, client, client->throttled_until_ms == 0, is_armed) == 0) {
+        client->is_write_armed = is_armed;
+    }
+}
+
+// stops reading the client for a throttle interval, TCP flow control slows the publisher down
+void ProcessingServer_throttle_client(ProcessingServer *server, ClientNode *client) {
+    if (client->throttled_until_ms || ProcessingServer_watch_client(server, client, 0, client->is_write_armed) < 0) {
+        return;
+    }
+    client->throttled_until_ms = clock_monotonic_ms() + THROTTLE_INTERVAL_MS;
+    ++server->throttled_count;
+    ++server->stats.reads_throttled;
+}
+
+// resumes reading clients whose interval is over, or all of them
+void ProcessingServer_release_throttled(ProcessingServer *server, int is_all) {
+    if (server->throttled_count == 0) {
+        return;
+    }
+
+    uint64_t now = clock_monotonic_ms();
+    for (ClientNode *client = server->clients; client; client = client->next) {
+        if (client->throttled_until_ms && (is_all || now >= client->throttled_until_ms)) {
+            ProcessingServer_watch_client(server, client, 1, client->is_write_armed);
+            client->throttled_until_ms = 0;
+            --server->throttled_count;
+        }
+    }
+}
+
+// queues the message, or its compressed variant if the client negotiated one; returns
+// 1 if it replaced a queued update for the same key, -1 if the client is too far behind
+int ProcessingServer_enqueue(ClientNode *client, OutboundLane lane, Message *message) {
+    if (client->codec != COMPRESSION_NONE && message->compressed) {
+        message = message->compressed;
+    }
+    if (OutboundQueue_bytes(client->outbound) + message->length > OUTBOUND_QUEUE_LIMIT) {
+        return -1;
+    }
+    return OutboundQueue_push(client->outbound, lane, message);
+}
+
+// queues the next part of the current state of every key, so a new client does not wait
+// for the next update; returns the number of updates queued, -1 on error
+int ProcessingServer_feed_last_values(ProcessingServer *server, ClientNode *client) {
+    size_t count = LastValueCache_count(server->last_values);
+    int queued = 0;
+
+    while (client->snapshot_next && client->snapshot_next <= count
+           && OutboundQueue_bytes(client->outbound) < FEED_BATCH_BYTES) {
+        Message *value = LastValueCache_get(server->last_values, client->snapshot_next++);
+        if (ProcessingServer_enqueue(client, LANE_MESSAGE, value) < 0) {
+            return -1;
+        }
+        ++queued;
+    }
+    if (client->snapshot_next > count) {
+        client->snapshot_next = 0;
+    }
+    return queued;
+}
+
+// queues the next part of a resume; returns the number of broadcasts queued, -1 on error
+int ProcessingServer_feed_resume(ProcessingServer *server, ClientNode *client) {
+    uint64_t end = client->is_multicast ? client->resume_end : MessageHistory_next_sequence(server->history);
+    uint64_t first = MessageHistory_first_sequence(server->history);
+    int queued = 0;
+
+    if (client->resume_next < first) {
+        client->resume_next = first; // evicted while waiting, those are gone for good
+    }
+    while (client->resume_next && client->resume_next < end
+           && OutboundQueue_bytes(client->outbound) < FEED_BATCH_BYTES) {
+        Message *message = MessageHistory_get(server->history, client->resume_next++);
+        if (message) {
+            if (ProcessingServer_enqueue(client, LANE_MESSAGE, message) < 0) {
+                return -1;
+            }
+            ++queued;
+        }
+    }
+    if (client->resume_next >= end) {
+        client->resume_next = 0;
+    }
+    return queued;
+}
+
+// writes queued frames until the socket buffer is full, returns -1 if the client is gone
+int ProcessingServer_flush_client(ProcessingServer *server, ClientNode *client) {
+    int allow_zerocopy = client->is_zerocopy;
+    size_t offset = 0;
+    Message *message;
+
+    for (;;) {
+        if (!(message = OutboundQueue_peek(client->outbound, &offset))) {
+            // the snapshot goes first, then the replay
+            int queued = client->snapshot_next ? ProcessingServer_feed_last_values(server, client) : 0;
+            if (queued == 0 && client->resume_next) {
+                queued = ProcessingServer_feed_resume(server, client);
+            }
+            if (queued < 0) {
+                return -1;
+            }
+            if (queued == 0) {
+                break;
+            }
+            continue;
+        }
+        int use_zerocopy = allow_zerocopy && message->length >= server->zerocopy_threshold;
+        ZerocopySend *pending = NULL;
+        if (use_zerocopy && !(pending = malloc(sizeof(ZerocopySend)))) {
+            use_zerocopy = 0; // nothing to keep the message alive with, copy instead
+        }
+        int flags = MSG_NOSIGNAL | (use_zerocopy ? MSG_ZEROCOPY : 0);
+        struct iovec iov[2];
+        struct msghdr header = {0};
+        header.msg_iov = iov;
+        header.msg_iovlen = (size_t) Message_get_iovec(message, offset, iov);
+        ssize_t sent = sendmsg(client->file_descriptor, &header, flags);
+        if (sent <= 0) {
+            free(pending);
+        }
+        if (sent == 0) {
+            return -1;
+        }
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (use_zerocopy && errno == ENOBUFS) {
+                allow_zerocopy = 0; // out of pinned-page budget, copy for now
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                ProcessingServer_arm_write(server, client, 1);
+                return 0;
+            }
+            if (errno != EPIPE && errno != ECONNRESET && errno != ECONNABORTED) {
+                perror("send");
+            }
+            return -1;
+        }
+
+        if (use_zerocopy) {
+            // counted once the completion arrives
+            ProcessingServer_track_zerocopy(server, client, pending, message, (size_t) sent);
+        } else {
+            server->stats.bytes_copied += (size_t) sent;
+        }
+        OutboundQueue_advance(client->outbound, (size_t) sent);
+    }
+
+    ProcessingServer_arm_write(server, client, 0);
+    return 0;
+}
+
+// queues and flushes the message for every ready client except one (may be NULL)
+void ProcessingServer_broadcast(ProcessingServer *server, Message *message, OutboundLane lane, const ClientNode *except) {
+    ClientNode *current = server->clients;
+    ClientNode *next;
+
+    ++server->stats.messages_broadcast;
+    int is_multicast = message->sequence != 0 && ProcessingServer_send_multicast(server, message);
+    if (is_multicast && server->multicast_client_count == server->client_count) {
+        return; // every client is subscribed, the datagram was all it took
+    }
+
+    // control frames, updates (already conflated) and stream chunks (flow controlled) are never shed,
+    // nor is anything a reliable subscriber would have to ack past
+    int is_shedding = server->load_level == LOAD_SHEDDING && lane == LANE_MESSAGE && message->sequence != 0
+                      && !server->is_reliable;
+    // a client still resuming gets sequenced chat from its replay cursor, in order, and a
+    // client still taking the snapshot gets the newest value of keys it has not reached
+    int is_replayed = lane == LANE_MESSAGE && message->sequence != 0;
+
+    while (current) {
+        next = current->next;
+        int is_receiving = current->is_ready && current != except && !(is_multicast && current->is_multicast)
+                           && !(is_replayed && current->resume_next && !current->is_multicast)
+                           && !(current->snapshot_next && message->key >= current->snapshot_next);
+        if (is_receiving && is_shedding && OutboundQueue_bytes(current->outbound) > SHED_BACKLOG) {
+            ++server->stats.messages_shed; // only what the client would have been sent over TCP
+        } else if (is_receiving) {
+            int result = ProcessingServer_enqueue(current, lane, message);
+            if (result == 1) {
+                ++server->stats.updates_conflated;
+            }
+            if (result < 0 || ProcessingServer_flush_client(server, current) < 0) {
+                Processing_server_detach_client(server, current->file_descriptor);
+            }
+        }
+        current = next;
+    }
+}
+
+// frames (and in encrypted mode seals) a payload once for all receivers
+Message *ProcessingServer_encode_flagged(ProcessingServer *server, uint8_t type, uint8_t flags, uint64_t sequence,
+                                         const void *payload, size_t length) {
+    int encode_error = 0;
+    Message *message = Message_create(FRAME_HEADER_SIZE + length + CRYPTO_SEAL_OVERHEAD, &encode_error);
+    if (encode_error) {
+        fprintf(stderr, "Failed to allocate broadcast\n");
+        return NULL;
+    }
+
+    CipherState *state = server->is_encrypted ? &server->group_cipher : NULL;
+    message->sequence = sequence;
+    message->payload_length = length;
+    message->length = Protocol_encode_flagged_frame(type, flags, sequence, state, payload, length, message->data,
+                                                    &encode_error);
+    if (encode_error) {
+        fprintf(stderr, "Failed to encode broadcast\n");
+        Message_release(message);
+        return NULL;
+    }
+    return message;
+}
+
+Message *ProcessingServer_encode_broadcast(ProcessingServer *server, uint8_t type, uint64_t sequence,
+                                           const void *payload, size_t length) {
+    return ProcessingServer_encode_flagged(server, type, 0, sequence, payload, length);
+}
+
+// attaches the compressed variant of a text broadcast, kept only if it is smaller
+void ProcessingServer_compress(ProcessingServer *server, Message *message, uint8_t flags, const void *payload,
+                               size_t length) {
+    if (!server->is_compressing || length == 0 || length < server->compression_threshold) {
+        return;
+    }
+
+    uint8_t packed[FRAME_MAX_PAYLOAD];
+    uint64_t started = clock_thread_cpu_ns();
+    size_t packed_length = lz_compress(payload, length, packed, length - 1);
+    if (packed_length > 0) {
+        message->compressed = ProcessingServer_encode_flagged(server, FRAME_TEXT, flags | FRAME_FLAG_COMPRESSED,
+                                                              message->sequence, packed, packed_length);
+    }
+    server->stats.compression_cpu_ns += clock_thread_cpu_ns() - started;
+
+    if (message->compressed) {
+        ++server->stats.messages_compressed;
+        server->stats.compression_bytes_in += length;
+        server->stats.compression_bytes_out += packed_length;
+    }
+}
+
+void ProcessingServer_retain(ProcessingServer *server, Message *message) {
+    if (MessageHistory_append(server->history, message)) {
+        ++server->stats.unacked_lost;
+    }
+    server->stats.retained_messages = MessageHistory_count(server->history);
+}
+
+// frames (and seals, in encrypted mode) the text once, keeps it in the history
+// and fans the same buffer out to every client on the given lane
+void ProcessingServer_publish_on(ProcessingServer *server, OutboundLane lane, const void *payload, size_t length,
+                                 int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (length > FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD) {
+        length = FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD;
+    }
+
+    // overtaking texts are flagged so clients do not take them as the newest sequence shown
+    uint8_t flags = lane == LANE_CONTROL ? FRAME_FLAG_PRIORITY : 0;
+    Message *message = ProcessingServer_encode_flagged(server, FRAME_TEXT, flags, server->next_sequence, payload,
+                                                       length);
+    if (!message) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+    ProcessingServer_compress(server, message, flags, payload, length);
+
+    ++server->next_sequence;
+    ProcessingServer_retain(server, message);
+    ProcessingServer_broadcast(server, message, lane, NULL);
+    Message_release(message);
+}
+
+void ProcessingServer_publish(ProcessingServer *server, const void *payload, size_t length, int *error_flag) {
+    ProcessingServer_publish_on(server, LANE_MESSAGE, payload, length, error_flag);
+}
+
+void ProcessingServer_announce(ProcessingServer *server, const void *payload, size_t length, int *error_flag) {
+    ProcessingServer_publish_on(server, LANE_CONTROL, payload, length, error_flag);
+}
+
+void ProcessingServer_publish_update(ProcessingServer *server, const void *key, size_t key_length, const void *value,
+                                     size_t value_length, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server || !key || key_length == 0 || key_length > UPDATE_MAX_KEY_LENGTH
+        || 1 + key_length + value_length > FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    payload[0] = (uint8_t) key_length;
+    memcpy(payload + 1, key, key_length);
+    memcpy(payload + 1 + key_length, value, value_length);
+
+    Message *message = ProcessingServer_encode_broadcast(server, FRAME_UPDATE, 0, payload, 1 + key_length + value_length);
+    if (!message || LastValueCache_store(server->last_values, key, key_length, message) < 0) {
+        Message_release(message);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    ++server->stats.updates_published;
+    server->stats.cached_keys = LastValueCache_count(server->last_values);
+    ProcessingServer_broadcast(server, message, LANE_MESSAGE, NULL);
+    Message_release(message);
+}
+
+// publisher's release callback, kept in the message allocation behind the frame header
+typedef struct {
+    ProcessingServerRelease release;
+    void *context;
+} ExternalRelease;
+
+void ProcessingServer_release_external(Message *message, void *context) {
+    ExternalRelease *external = context;
+    external->release(external->context, message->external);
+}
+
+void ProcessingServer_publish_external(ProcessingServer *server, const void *buffer, size_t length,
+                                       ProcessingServerRelease release, void *context, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server || !buffer || !release || length > FRAME_MAX_PAYLOAD - CRYPTO_SEAL_OVERHEAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    if (server->is_encrypted) {
+        // sealing writes ciphertext into a buffer of our own, the caller's is done with right away
+        ProcessingServer_publish(server, buffer, length, error_flag);
+        release(context, buffer);
+        return;
+    }
+
+    int create_error = 0;
+    Message *message = Message_create(FRAME_HEADER_SIZE + sizeof(ExternalRelease), &create_error);
+    if (create_error) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    FrameHeader header = {FRAME_TEXT, 0, (uint32_t) length, server->next_sequence};
+    Protocol_encode_header(&header, message->data);
+    ExternalRelease *external = (ExternalRelease *) (message->data + FRAME_HEADER_SIZE);
+    external->release = release;
+    external->context = context;
+
+    message->sequence = server->next_sequence++;
+    message->payload_length = length;
+    message->external = buffer;
+    message->external_length = length;
+    message->length = FRAME_HEADER_SIZE + length;
+    message->release_callback = ProcessingServer_release_external;
+    message->release_context = external;
+    ProcessingServer_compress(server, message, 0, buffer, length);
+
+    ProcessingServer_retain(server, message);
+    ProcessingServer_broadcast(server, message, LANE_MESSAGE, NULL);
+    Message_release(message);
+}
+
+// points the client's replay cursor at the retained broadcasts it has not seen yet,
+// flush_client queues them as the client drains its queue
+void ProcessingServer_resume_client(ProcessingServer *server, ClientNode *client, uint64_t epoch, uint64_t last_sequence) {
+    uint64_t end = MessageHistory_next_sequence(server->history);
+    client->acked_sequence = server->next_sequence - 1;
+    if (epoch == 0) {
+        return; // first connection, nothing to resume
+    }
+
+    uint64_t sequence = MessageHistory_first_sequence(server->history);
+    if (epoch == server->epoch && last_sequence + 1 > sequence) {
+        sequence = last_sequence + 1;
+    }
+    // a different epoch means the relay restarted: everything retained is new to the client
+    if (sequence < end) {
+        client->acked_sequence = sequence - 1;
+        client->resume_next = sequence;
+        client->resume_end = end;
+    }
+}
+
+int ProcessingServer_handle_hello(ProcessingServer *server, ClientNode *client, const FrameHeader *header, const uint8_t *payload) {
+    if (header->type != FRAME_HELLO || header->length != HELLO_PAYLOAD_SIZE || payload[0] != PROTOCOL_VERSION) {
+        return -1;
+    }
+
+    const uint8_t *client_public_key = payload + 1;
+    uint64_t resume_epoch = Protocol_read_u64(client_public_key + CRYPTO_PUBLIC_KEY_SIZE);
+    uint64_t resume_sequence = Protocol_read_u64(client_public_key + CRYPTO_PUBLIC_KEY_SIZE + 8);
+    uint8_t codecs = payload[HELLO_PAYLOAD_SIZE - 1];
+    client->codec = server->is_compressing && (codecs & COMPRESSION_LZ) ? COMPRESSION_LZ : COMPRESSION_NONE;
+
+    int create_error = 0;
+    Message *welcome = Message_create(FRAME_HEADER_SIZE + WELCOME_SEALED_PAYLOAD_SIZE, &create_error);
+    if (create_error) {
+        return -1;
+    }
+
+    FrameHeader welcome_header = {FRAME_WELCOME, 0, WELCOME_PAYLOAD_SIZE, 0};
+    uint8_t *welcome_payload = welcome->data + FRAME_HEADER_SIZE;
+    Protocol_write_u64(welcome_payload, server->epoch);
+    welcome_payload[8] = client->codec;
+
+    if (server->is_encrypted) {
+        uint8_t private_key[CRYPTO_KEY_SIZE];
+        uint8_t *public_key = welcome_payload + WELCOME_PAYLOAD_SIZE;
+        CipherState send_state = {{0}, 0};
+        int crypto_error = 0;
+
+        crypto_generate_keypair(private_key, public_key, &crypto_error);
+        if (!crypto_error) {
+            crypto_derive_session_keys(private_key, client_public_key, 1, client->receive_key, send_state.key, &crypto_error);
+        }
+        memset(private_key, 0, sizeof(private_key));
+
+        // epoch and server public key in the clear, group key sealed with the session key;
+        // everything before the sealed part is authenticated
+        welcome_header.flags = FRAME_FLAG_SEALED;
+        welcome_header.length = WELCOME_SEALED_PAYLOAD_SIZE;
+        Protocol_encode_header(&welcome_header, welcome->data);
+        size_t aad_length = FRAME_HEADER_SIZE + WELCOME_PAYLOAD_SIZE + CRYPTO_PUBLIC_KEY_SIZE;
+        if (!crypto_error) {
+            crypto_seal(&send_state, welcome->data, aad_length, server->group_cipher.key, CRYPTO_KEY_SIZE,
+                        welcome->data + aad_length, &crypto_error);
+        }
+        memset(&send_state, 0, sizeof(send_state));
+        if (crypto_error) {
+            Message_release(welcome);
+            return -1;
+        }
+        client->next_receive_nonce = 0;
+    } else {
+        Protocol_encode_header(&welcome_header, welcome->data);
+    }
+    welcome->length = FRAME_HEADER_SIZE + welcome_header.length;
+
+    int enqueue_error = ProcessingServer_enqueue(client, LANE_CONTROL, welcome);
+    Message_release(welcome);
+
+    if (enqueue_error < 0) {
+        return -1;
+    }
+    ProcessingServer_resume_client(server, client, resume_epoch, resume_sequence);
+
+    // on the control lane, so it arrives before the replay
+    if (server->multicast_file_descriptor >= 0) {
+        uint8_t group[MULTICAST_PAYLOAD_SIZE];
+        memcpy(group, &server->multicast_address.sin_addr.s_addr, 4);
+        memcpy(group + 4, &server->multicast_address.sin_port, 2);
+        Protocol_write_u64(group + 6, client->acked_sequence);
+        Protocol_write_u64(group + 14, server->next_sequence - 1);
+        Message *announcement = ProcessingServer_encode_broadcast(server, FRAME_MULTICAST, 0, group, sizeof(group));
+        enqueue_error = announcement ? ProcessingServer_enqueue(client, LANE_CONTROL, announcement) : -1;
+        Message_release(announcement);
+    }
+    if (enqueue_error < 0) {
+        return -1;
+    }
+    client->snapshot_next = LastValueCache_count(server->last_values) ? 1 : 0;
+    if (server->is_reliable) {
+        MessageHistory_hold(server->history, client->acked_sequence);
+        client->is_holding = 1;
+        if (resume_epoch == server->epoch) {
+            ProcessingServer_reclaim_lingering(server, resume_sequence); // after the new hold pinned the replay
+        }
+    }
+
+    client->is_ready = 1;
+    if (server->callbacks.on_connect) {
+        server->callbacks.on_connect(server->callbacks.context, client->connection_id, &client->address);
+    }
+    return ProcessingServer_flush_client(server, client);
+}
+
+// checks and, in encrypted mode, opens a client payload;
+// returns plaintext length or -1 if the frame is not acceptable from this client
+ssize_t ProcessingServer_open_payload(ProcessingServer *server, ClientNode *client, const FrameHeader *header,
+                                      const uint8_t *payload, uint8_t *out) {
+    if (!server->is_encrypted) {
+        if (header->flags & FRAME_FLAG_SEALED) {
+            return -1;
+        }
+        memcpy(out, payload, header->length);
+        return (ssize_t) header->length;
+    }
+
+    if (!(header->flags & FRAME_FLAG_SEALED)) {
+        return -1;
+    }
+
+    int open_error = 0;
+    uint64_t nonce_counter = 0;
+    size_t length = Protocol_open_frame(header, payload, client->receive_key, out, &nonce_counter, &open_error);
+    if (open_error || nonce_counter < client->next_receive_nonce) {
+        return -1; // forged or replayed
+    }
+    client->next_receive_nonce = nonce_counter + 1;
+    return (ssize_t) length;
+}
+
+void ProcessingServer_describe_client(const ClientNode *client, char *out, size_t size) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client->address.sin_addr, ip, sizeof(ip));
+    snprintf(out, size, "%s:%d", ip, ntohs(client->address.sin_port));
+}
+
+InboundStream *ProcessingServer_find_stream(ProcessingServer *server, const ClientNode *owner, uint32_t sender_stream_id) {
+    for (InboundStream *stream = server->streams; stream; stream = stream->next) {
+        if (stream->owner == owner && stream->sender_stream_id == sender_stream_id) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+// last queue let go of a relayed chunk: its bytes may be granted back to the sender
+void ProcessingServer_release_chunk(Message *message, void *context) {
+    InboundStream *stream = context;
+    stream->pending_credit += message->payload_length - STREAM_ID_SIZE;
+    --stream->chunks_in_flight;
+}
+
+int ProcessingServer_send_window(ProcessingServer *server, InboundStream *stream) {
+    uint8_t payload[WINDOW_PAYLOAD_SIZE];
+    uint32_t credit = stream->pending_credit > UINT32_MAX ? UINT32_MAX : (uint32_t) stream->pending_credit;
+    Protocol_write_u32(payload, stream->sender_stream_id);
+    Protocol_write_u32(payload + STREAM_ID_SIZE, credit);
+
+    Message *message = ProcessingServer_encode_broadcast(server, FRAME_WINDOW, 0, payload, sizeof(payload));
+    if (!message) {
+        return 0; // credit stays pending, retried on the next pass
+    }
+    stream->window += credit;
+    stream->pending_credit -= credit;
+
+    int result = ProcessingServer_enqueue(stream->owner, LANE_CONTROL, message);
+    Message_release(message);
+    if (result < 0) {
+        return -1;
+    }
+    return ProcessingServer_flush_client(server, stream->owner);
+}
+
+void ProcessingServer_publish_stream_end(ProcessingServer *server, const InboundStream *stream, uint8_t status) {
+    uint8_t payload[STREAM_ID_SIZE + 1];
+    Protocol_write_u32(payload, stream->relay_stream_id);
+    payload[STREAM_ID_SIZE] = status;
+
+    Message *message = ProcessingServer_encode_broadcast(server, FRAME_STREAM_END, 0, payload, sizeof(payload));
+    if (message) {
+        ProcessingServer_broadcast(server, message, LANE_STREAM, stream->owner);
+        Message_release(message);
+    }
+}
+
+// grants released credit back to senders, announces aborted streams and frees
+// streams whose last chunk has been written everywhere
+void ProcessingServer_service_streams(ProcessingServer *server) {
+    InboundStream **link = &server->streams;
+    while (*link) {
+        InboundStream *stream = *link;
+
+        if (stream->is_aborted) {
+            stream->is_aborted = 0;
+            ProcessingServer_publish_stream_end(server, stream, STREAM_ABORTED);
+
+            char line[BUFSIZ];
+            snprintf(line, sizeof(line), "Stream %s aborted", stream->name);
+            ProcessingServer_log(server, line);
+        }
+
+        if (!stream->is_open && stream->chunks_in_flight == 0) {
+            *link = stream->next;
+            free(stream);
+            continue;
+        }
+
+        // while shedding, senders get no new credit and their uploads pause
+        if (stream->is_open && stream->owner && stream->pending_credit > 0 && server->load_level != LOAD_SHEDDING
+            && ProcessingServer_send_window(server, stream) < 0) {
+            Processing_server_detach_client(server, stream->owner->file_descriptor);
+        }
+        link = &stream->next;
+    }
+}
+
+int ProcessingServer_handle_stream_start(ProcessingServer *server, ClientNode *client, uint8_t *payload, size_t length) {
+    if (length < STREAM_START_PREFIX_SIZE || client->stream_count >= MAX_STREAMS_PER_CLIENT) {
+        return -1;
+    }
+
+    uint32_t sender_stream_id = Protocol_read_u32(payload);
+    if (ProcessingServer_find_stream(server, client, sender_stream_id)) {
+        return -1;
+    }
+
+    InboundStream *stream = calloc(1, sizeof(InboundStream));
+    if (!stream) {
+        return -1;
+    }
+
+    // receivers see the sender in front of the name: "ip:port/name"
+    char sender[INET_ADDRSTRLEN + 8];
+    ProcessingServer_describe_client(client, sender, sizeof(sender));
+    size_t name_length = length - STREAM_START_PREFIX_SIZE;
+    if (name_length > MAX_STREAM_NAME_LENGTH) {
+        name_length = MAX_STREAM_NAME_LENGTH;
+    }
+    snprintf(stream->name, sizeof(stream->name), "%s/%.*s", sender, (int) name_length,
+             (const char *) payload + STREAM_START_PREFIX_SIZE);
+
+    stream->sender_stream_id = sender_stream_id;
+    stream->relay_stream_id = server->next_stream_id++;
+    stream->owner = client;
+    stream->is_open = 1;
+    stream->pending_credit = STREAM_INITIAL_WINDOW;
+    stream->next = server->streams;
+    server->streams = stream;
+    ++client->stream_count;
+
+    uint64_t total_size = Protocol_read_u64(payload + STREAM_ID_SIZE);
+    uint8_t start[STREAM_START_PREFIX_SIZE + sizeof(stream->name)];
+    Protocol_write_u32(start, stream->relay_stream_id);
+    Protocol_write_u64(start + STREAM_ID_SIZE, total_size);
+    memcpy(start + STREAM_START_PREFIX_SIZE, stream->name, strlen(stream->name));
+
+    Message *message = ProcessingServer_encode_broadcast(server, FRAME_STREAM_START, 0, start,
+                                                         STREAM_START_PREFIX_SIZE + strlen(stream->name));
+    if (message) {
+        ProcessingServer_broadcast(server, message, LANE_STREAM, client);
+        Message_release(message);
+    }
+
+    char line[BUFSIZ];
+    snprintf(line, sizeof(line), "Stream %s started (%llu bytes)", stream->name, (unsigned long long) total_size);
+    ProcessingServer_log(server, line);
+    return 0;
+}
+
+int ProcessingServer_handle_stream_data(ProcessingServer *server, ClientNode *client, uint8_t *payload, size_t length) {
+    if (length < STREAM_ID_SIZE) {
+        return -1;
+    }
+
+    InboundStream *stream = ProcessingServer_find_stream(server, client, Protocol_read_u32(payload));
+    size_t chunk_length = length - STREAM_ID_SIZE;
+    if (!stream || !stream->is_open || chunk_length > stream->window) {
+        return -1; // the sender ignored its window
+    }
+    stream->window -= chunk_length;
+
+    // the payload buffer is reused: only the stream id changes on the way out
+    Protocol_write_u32(payload, stream->relay_stream_id);
+    Message *message = ProcessingServer_encode_broadcast(server, FRAME_STREAM_DATA, 0, payload, length);
+    if (!message) {
+        stream->pending_credit += chunk_length;
+        return 0;
+    }
+
+    message->release_callback = ProcessingServer_release_chunk;
+    message->release_context = stream;
+    ++stream->chunks_in_flight;
+    ProcessingServer_broadcast(server, message, LANE_STREAM, client);
+    Message_release(message);
+    return 0;
+}
+
+int ProcessingServer_handle_stream_end(ProcessingServer *server, ClientNode *client, const uint8_t *payload, size_t length) {
+    if (length < STREAM_ID_SIZE + 1) {
+        return -1;
+    }
+
+    InboundStream *stream = ProcessingServer_find_stream(server, client, Protocol_read_u32(payload));
+    if (!stream || !stream->is_open) {
+        return -1;
+    }
+
+    uint8_t status = payload[STREAM_ID_SIZE] == STREAM_COMPLETE ? STREAM_COMPLETE : STREAM_ABORTED;
+    ProcessingServer_publish_stream_end(server, stream, status);
+    stream->is_open = 0;
+    stream->owner = NULL;
+    --client->stream_count;
+
+    char line[BUFSIZ];
+    snprintf(line, sizeof(line), "Stream %s %s", stream->name, status == STREAM_COMPLETE ? "finished" : "aborted");
+    ProcessingServer_log(server, line);
+    return 0;
+}
+
+void ProcessingServer_handle_subscribe(ProcessingServer *server, ClientNode *client) {
+    if (server->multicast_file_descriptor >= 0 && !client->is_multicast) {
+        client->is_multicast = 1;
+        ++server->multicast_client_count;
+        // broadcasts until now went over TCP, so the replay covers them before the group takes over
+        client->resume_end = MessageHistory_next_sequence(server->history);
+    }
+}
+
+// resends the requested sequences over TCP from the history, older ones are gone for good
+int ProcessingServer_handle_nack(ProcessingServer *server, ClientNode *client, const uint8_t *payload, size_t length) {
+    if (length != NACK_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    uint64_t sequence = Protocol_read_u64(payload);
+    uint64_t count = Protocol_read_u32(payload + 8);
+    uint64_t first = MessageHistory_first_sequence(server->history);
+    uint64_t end = MessageHistory_next_sequence(server->history);
+    if (sequence < first) {
+        count = sequence + count > first ? sequence + count - first : 0;
+        sequence = first;
+    }
+
+    ++server->stats.nack_requests;
+    for (; count > 0 && sequence < end; --count, ++sequence) {
+        if (ProcessingServer_enqueue(client, LANE_MESSAGE, MessageHistory_get(server->history, sequence)) < 0) {
+            return -1;
+        }
+        ++server->stats.messages_repaired;
+    }
+    return ProcessingServer_flush_client(server, client);
+}
+
+void ProcessingServer_handle_text(ProcessingServer *server, ClientNode *client, const char *text, size_t length) {
+    char message_buffer[BUFSIZ];
+    char sender[INET_ADDRSTRLEN + 8];
+    ProcessingServer_describe_client(client, sender, sizeof(sender));
+
+    size_t display_length = length;
+    if (display_length >= MAX_MESSAGE_LENGTH) {
+        display_length = MAX_MESSAGE_LENGTH;
+    }
+
+    snprintf(message_buffer, sizeof(message_buffer), "[%s]: %.*s", sender, (int) display_length, text);
+    ProcessingServer_publish(server, message_buffer, strlen(message_buffer), NULL);
+    ProcessingServer_log(server, message_buffer);
+
+    if (server->callbacks.on_message) {
+        server->callbacks.on_message(server->callbacks.context, client->connection_id, text, length);
+    }
+}
+
+// relays a client's keyed update; a full cache drops it, the producer is not at fault
+int ProcessingServer_handle_update(ProcessingServer *server, const uint8_t *payload, size_t length) {
+    if (length < 1 || payload[0] == 0 || payload[0] > length - 1) {
+        return -1;
+    }
+
+    size_t key_length = payload[0];
+    int publish_error = 0;
+    ProcessingServer_publish_update(server, payload + 1, key_length, payload + 1 + key_length, length - 1 - key_length,
+                                    &publish_error);
+    if (publish_error) {
+        ProcessingServer_log(server, "Update dropped, the last-value cache is full");
+    }
+    return 0;
+}
+
+// cumulative: releases every sequence between the previous ACK and this one,
+// each broadcast is touched once per subscriber however acks are batched
+int ProcessingServer_handle_ack(ProcessingServer *server, ClientNode *client, const uint8_t *payload, size_t length) {
+    if (length != ACK_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    uint64_t sequence = Protocol_read_u64(payload);
+    ++server->stats.acks_received;
+    if (sequence >= server->next_sequence) {
+        sequence = server->next_sequence - 1; // cannot have been delivered
+    }
+    if (!client->is_holding || sequence <= client->acked_sequence) {
+        return 0;
+    }
+
+    MessageHistory_acknowledge(server->history, client->acked_sequence, sequence);
+    client->acked_sequence = sequence;
+    server->stats.retained_messages = MessageHistory_count(server->history);
+    return 0;
+}
+
+// handles every buffered frame of the client, returns -1 on protocol violation
+int ProcessingServer_process_frames(ProcessingServer *server, ClientNode *client) {
+    FrameHeader header;
+    const uint8_t *payload = NULL;
+    int frame_error = 0;
+    uint8_t plaintext[FRAME_MAX_PAYLOAD + 1];
+
+    while (FrameReader_next(client->reader, &header, &payload, &frame_error)) {
+        if (!client->is_ready) {
+            if (ProcessingServer_handle_hello(server, client, &header, payload) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        ssize_t length = ProcessingServer_open_payload(server, client, &header, payload, plaintext);
+        if (length < 0) {
+            return -1;
+        }
+        ProcessingServer_capture(server, client, TRACE_FRAME, header.type, plaintext, (size_t) length);
+
+        int result = -1;
+        switch (header.type) {
+            case FRAME_TEXT:
+                ProcessingServer_handle_text(server, client, (const char *) plaintext, (size_t) length);
+                result = 0;
+                break;
+            case FRAME_STREAM_START:
+                result = ProcessingServer_handle_stream_start(server, client, plaintext, (size_t) length);
+                break;
+            case FRAME_STREAM_DATA:
+                result = ProcessingServer_handle_stream_data(server, client, plaintext, (size_t) length);
+                break;
+            case FRAME_STREAM_END:
+                result = ProcessingServer_handle_stream_end(server, client, plaintext, (size_t) length);
+                break;
+            case FRAME_SUBSCRIBE:
+                ProcessingServer_handle_subscribe(server, client);
+                result = 0;
+                break;
+            case FRAME_NACK:
+                result = ProcessingServer_handle_nack(server, client, plaintext, (size_t) length);
+                break;
+            case FRAME_UPDATE:
+                result = ProcessingServer_handle_update(server, plaintext, (size_t) length);
+                break;
+            case FRAME_ACK:
+                result = ProcessingServer_handle_ack(server, client, plaintext, (size_t) length);
+                break;
+            default:
+                break;
+        }
+        if (result < 0) {
+            return -1;
+        }
+    }
+
+    return frame_error ? -1 : 0;
+}
+
+// newest sequence to the group once per interval, a receiver that lost the last
+// broadcasts has no later datagram that would reveal the gap
+void ProcessingServer_send_heartbeat(ProcessingServer *server) {
+    uint64_t now = clock_monotonic_ms();
+    if (server->multicast_client_count == 0 || server->next_sequence == 1 || now < server->next_heartbeat_ms) {
+        return;
+    }
+    server->next_heartbeat_ms = now + HEARTBEAT_INTERVAL_MS;
+
+    Message *heartbeat = ProcessingServer_encode_broadcast(server, FRAME_HEARTBEAT, server->next_sequence - 1, "", 0);
+    if (heartbeat) {
+        ProcessingServer_send_multicast(server, heartbeat);
+        Message_release(heartbeat);
+    }
+}
+
+void ProcessingServer_show_stats(ProcessingServer *server) {
+    char line[BUFSIZ];
+    snprintf(line, sizeof(line), "[STATS] clients: %d, broadcasts: %llu",
+             server->client_count, (unsigned long long) server->stats.messages_broadcast);
+    ProcessingServer_log(server, line);
+    snprintf(line, sizeof(line), "[STATS] bytes copied: %llu, zero-copied: %llu, zero-copy fell back: %llu",
+             (unsigned long long) server->stats.bytes_copied,
+             (unsigned long long) server->stats.bytes_zerocopy,
+             (unsigned long long) server->stats.bytes_zerocopy_copied);
+    ProcessingServer_log(server, line);
+    if (server->multicast_file_descriptor >= 0) {
+        snprintf(line, sizeof(line), "[STATS] multicast clients: %d, datagrams: %llu, nacks: %llu, repaired: %llu",
+                 server->multicast_client_count, (unsigned long long) server->stats.multicast_datagrams,
+                 (unsigned long long) server->stats.nack_requests, (unsigned long long) server->stats.messages_repaired);
+        ProcessingServer_log(server, line);
+    }
+    snprintf(line, sizeof(line), "[STATS] load: %llu, loop lag: %.3f ms (max %.3f), throttled reads: %llu, shed: %llu",
+             (unsigned long long) server->stats.load_level, (double) server->stats.loop_lag_us / 1e3,
+             (double) server->stats.loop_lag_max_us / 1e3,
+             (unsigned long long) server->stats.reads_throttled, (unsigned long long) server->stats.messages_shed);
+    ProcessingServer_log(server, line);
+    if (server->is_reliable) {
+        snprintf(line, sizeof(line), "[STATS] reliable: retained %llu, acks %llu, lingering %llu, unacked lost %llu",
+                 (unsigned long long) server->stats.retained_messages, (unsigned long long) server->stats.acks_received,
+                 (unsigned long long) server->stats.lingering_subscribers,
+                 (unsigned long long) server->stats.unacked_lost);
+        ProcessingServer_log(server, line);
+    }
+    if (server->stats.updates_published > 0) {
+        snprintf(line, sizeof(line), "[STATS] keys: %llu, updates: %llu, conflated: %llu",
+                 (unsigned long long) server->stats.cached_keys, (unsigned long long) server->stats.updates_published,
+                 (unsigned long long) server->stats.updates_conflated);
+        ProcessingServer_log(server, line);
+    }
+    if (server->is_compressing) {
+        const ProcessingServerStats *stats = &server->stats;
+        snprintf(line, sizeof(line), "[STATS] compressed: %llu, bytes in: %llu, out: %llu (ratio %.2f), cpu: %.3f ms",
+                 (unsigned long long) stats->messages_compressed, (unsigned long long) stats->compression_bytes_in,
+                 (unsigned long long) stats->compression_bytes_out,
+                 stats->compression_bytes_out ? (double) stats->compression_bytes_in / (double) stats->compression_bytes_out : 0.0,
+                 (double) stats->compression_cpu_ns / 1e6);
+        ProcessingServer_log(server, line);
+    }
+}
+
+// reads what the client sent and handles complete frames, returns -1 if the client has to go
+int ProcessingServer_handle_client(ProcessingServer *server, ClientNode *client) {
+    // readiness may only mean zero-copy completions are queued
+    ProcessingServer_reap_zerocopy(server, client);
+
+    int read_error = 0;
+    ssize_t bytes_read = FrameReader_fill(client->reader, client->file_descriptor, MSG_DONTWAIT, &read_error);
+    if (bytes_read < 0 && !read_error) {
+        return 0;
+    }
+
+    if (bytes_read <= 0 || read_error) {
+        return -1;
+    }
+    return ProcessingServer_process_frames(server, client);
+}
+
+// one line typed on the server console: a command or a message to broadcast
+void ProcessingServer_handle_console_input(ProcessingServer *server) {
+    char buffer[BUFSIZ];
+    if (fgets(buffer, sizeof(buffer), stdin) == NULL || strcmp(buffer, "exit()\n") == 0) {
+        server->is_running = 0;
+        return;
+    }
+
+    if (strcmp(buffer, "stats()\n") == 0) {
+        ProcessingServer_show_stats(server);
+        return;
+    }
+
+    char message_buffer[BUFSIZ];
+    snprintf(message_buffer, sizeof(message_buffer), "[SERVER]: %.*s", (int) strlen(buffer), buffer);
+    ProcessingServer_announce(server, message_buffer, strlen(message_buffer), NULL);
+    ProcessingServer_log(server, buffer);
+}
+
+void ProcessingServer_handle_listen(ProcessingServer *server) {
+    struct sockaddr_in client_address;
+    int accept_error = 0;
+    int client_fd = ProcessingServer_accept_connection(server->listen_file_descriptor, &client_address, &accept_error);
+
+    if (client_fd >= 0 && ProcessingServer_attach_client(server, client_fd, &client_address) == 0) {
+        char ip[INET_ADDRSTRLEN];
+        char line[BUFSIZ];
+        inet_ntop(AF_INET, &client_address.sin_addr, ip, sizeof(ip));
+        snprintf(line, sizeof(line), "Client connected: %s:%d", ip, ntohs(client_address.sin_port));
+        ProcessingServer_log(server, line);
+    }
+}
+
+void ProcessingServer_set_load_level(ProcessingServer *server, ProcessingServerLoad level) {
+    static const char *const descriptions[] = {
+        [LOAD_NORMAL] = "normal",
+        [LOAD_ACCEPTS_PAUSED] = "accepts paused",
+        [LOAD_PUBLISHERS_THROTTLED] = "publishers throttled",
+        [LOAD_SHEDDING] = "shedding fan-out"
+    };
+
+    if ((level == LOAD_NORMAL) != (server->load_level == LOAD_NORMAL)) {
+        struct epoll_event event;
+        event.events = level == LOAD_NORMAL ? EPOLLIN : 0;
+        event.data.ptr = &listen_event_tag;
+        epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_MOD, server->listen_file_descriptor, &event);
+    }
+    if (level < LOAD_PUBLISHERS_THROTTLED) {
+        ProcessingServer_release_throttled(server, 1);
+    }
+
+    server->load_level = level;
+    server->stats.load_level = level;
+    ++server->stats.load_transitions;
+
+    char line[BUFSIZ];
+    snprintf(line, sizeof(line), "Load: %s (loop lag %.2f ms)", descriptions[level], (double) server->loop_lag_ns / 1e6);
+    ProcessingServer_log(server, line);
+}
+
+// folds the iteration into the lag average and moves between load levels: up as soon as
+// the lag crosses a level's threshold, down one level at a time after LOAD_HOLD_MS calm
+void ProcessingServer_update_load(ProcessingServer *server, uint64_t iteration_ns) {
+    server->loop_lag_ns = (server->loop_lag_ns * 7 + iteration_ns) / 8;
+    server->stats.loop_lag_us = server->loop_lag_ns / 1000;
+    if (iteration_ns / 1000 > server->stats.loop_lag_max_us) {
+        server->stats.loop_lag_max_us = iteration_ns / 1000;
+    }
+
+    if (server->overload_threshold_ns == 0) {
+        return;
+    }
+
+    ProcessingServerLoad target = LOAD_NORMAL;
+    while (target < LOAD_SHEDDING && server->loop_lag_ns >= server->overload_threshold_ns << target) {
+        ++target;
+    }
+
+    if (target > server->load_level) {
+        server->load_calm_since_ms = 0;
+        ProcessingServer_set_load_level(server, target);
+        return;
+    }
+
+    uint64_t exit_threshold_ns = server->load_level == LOAD_NORMAL
+                                 ? 0 : (server->overload_threshold_ns << (server->load_level - 1)) / 2;
+    if (server->loop_lag_ns >= exit_threshold_ns) {
+        server->load_calm_since_ms = 0;
+        return;
+    }
+
+    uint64_t now = clock_monotonic_ms();
+    if (server->load_calm_since_ms == 0) {
+        server->load_calm_since_ms = now;
+    } else if (now - server->load_calm_since_ms >= LOAD_HOLD_MS) {
+        server->load_calm_since_ms = now;
+        ProcessingServer_set_load_level(server, server->load_level - 1);
+    }
+}
+
+int ProcessingServer_poll_once(ProcessingServer *server, int timeout_ms, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!server) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return -1;
+    }
+
+    if (server->multicast_file_descriptor >= 0 && (timeout_ms < 0 || timeout_ms > HEARTBEAT_INTERVAL_MS)) {
+        timeout_ms = HEARTBEAT_INTERVAL_MS;
+    }
+    // throttled clients have to be resumed and a calm loop has to be noticed without events
+    if ((server->load_level != LOAD_NORMAL || server->throttled_count > 0)
+        && (timeout_ms < 0 || timeout_ms > THROTTLE_INTERVAL_MS)) {
+        timeout_ms = THROTTLE_INTERVAL_MS;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int ready = epoll_wait(server->epoll_file_descriptor, events, MAX_EVENTS, timeout_ms);
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror("epoll_wait");
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return -1;
+    }
+
+    uint64_t started_ns = clock_monotonic_ns();
+    if (server->multicast_file_descriptor >= 0) {
+        ProcessingServer_send_heartbeat(server);
+    }
+    ProcessingServer_release_throttled(server, 0);
+
+    for (int i = 0; i < ready; ++i) {
+        void *tag = events[i].data.ptr;
+
+        if (tag == &stdin_event_tag) {
+            ProcessingServer_handle_console_input(server);
+            continue;
+        }
+
+        if (tag == &listen_event_tag) {
+            ProcessingServer_handle_listen(server);
+            continue;
+        }
+
+        ClientNode *client = tag;
+        if (client->file_descriptor < 0) {
+            continue; // detached earlier in this batch
+        }
+
+        int result = 0;
+        if (events[i].events & EPOLLOUT) {
+            result = ProcessingServer_flush_client(server, client);
+        }
+        if (result == 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+            result = ProcessingServer_handle_client(server, client);
+            if (result == 0 && server->load_level >= LOAD_PUBLISHERS_THROTTLED) {
+                ProcessingServer_throttle_client(server, client);
+            }
+        }
+
+        if (result < 0) {
+            char sender[INET_ADDRSTRLEN + 8];
+            char line[BUFSIZ];
+            ProcessingServer_describe_client(client, sender, sizeof(sender));
+            snprintf(line, sizeof(line), "Client %s disconnected", sender);
+            ProcessingServer_log(server, line);
+
+            Processing_server_detach_client(server, client->file_descriptor);
+        }
+    }
+
+    ProcessingServer_service_streams(server);
+    ProcessingServer_free_detached_clients(server);
+    ProcessingServer_expire_lingering(server, 0);
+    ProcessingServer_update_load(server, clock_monotonic_ns() - started_ns);
+    return ready;
+}
+
+void ProcessingServer_run(ProcessingServer *server, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (server->is_busy_poll && server->busy_poll_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(server->busy_poll_cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            perror("sched_setaffinity");
+            if (error_flag) {
+                *error_flag = 1;
+            }
+            return;
+        }
+    }
+
+    // a regular file or /dev/null on stdin cannot be polled, the server then runs without input
+    struct epoll_event stdin_event;
+    stdin_event.events = EPOLLIN;
+    stdin_event.data.ptr = &stdin_event_tag;
+    int has_stdin = epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_ADD, STDIN_FILENO, &stdin_event) == 0;
+
+    int create_console_error = 0;
+    Console *console = Console_create(&create_console_error);
+    if (create_console_error) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    clear_screen();
+    hide_cursor();
+    for (int i = 0; i < MESSAGES_DISPLAYED; ++i) {
+        Console_add_message(console, "");
+    }
+    Console_render(console);
+    server->console = console;
+
+    uint64_t last_activity_ns = 0;
+    uint64_t last_render_ns = 0;
+    server->is_running = 1;
+    while (server->is_running) {
+        // busy-poll mode spins on a zero timeout until the loop has been idle for the
+        // spin window, the clock read is a vDSO call, so epoll_wait is the only syscall
+        uint64_t now_ns = clock_monotonic_ns();
+        int is_spinning = server->is_busy_poll && now_ns - last_activity_ns < server->busy_poll_spin_ns;
+        if (server->is_console_stale
+            && (!is_spinning || now_ns - last_render_ns >= (uint64_t) CONSOLE_RENDER_INTERVAL_MS * 1000000)) {
+            Console_render(console);
+            server->is_console_stale = 0;
+            last_render_ns = now_ns;
+        }
+        int timeout = is_spinning ? 0 : -1;
+
+        int poll_error = 0;
+        int handled = ProcessingServer_poll_once(server, timeout, &poll_error);
+        if (poll_error) {
+            break;
+        }
+        if (handled > 0 && server->is_busy_poll) {
+            last_activity_ns = clock_monotonic_ns();
+        }
+    }
+
+    if (has_stdin) {
+        epoll_ctl(server->epoll_file_descriptor, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+    }
+
+    server->console = NULL;
+    move_cursor(AT_EXIT_MESSAGE_ROW, 1);
+    reset_terminal();
+    show_cursor();
+    printf("Server stopped successfully.\n");
+    Console_destroy(console);
+}
+
+void ProcessingServer_destroy(ProcessingServer *server) {
+    ClientNode *current = server->clients;
+    while (current) {
+        ClientNode *next = current->next;
+        ProcessingServer_free_client(server, current);
+        current = next;
+    }
+    ProcessingServer_free_detached_clients(server);
+
+    while (server->streams) {
+        InboundStream *next = server->streams->next;
+        free(server->streams);
+        server->streams = next;
+    }
+
+    if (server->listen_file_descriptor >= 0) {
+        close(server->listen_file_descriptor);
+    }
+    close(server->epoll_file_descriptor);
+
+    TraceWriter_destroy(server->capture);
+    if (server->multicast_file_descriptor >= 0) {
+        close(server->multicast_file_descriptor);
+    }
+    ProcessingServer_expire_lingering(server, 1);
+    MessageHistory_destroy(server->history);
+    LastValueCache_destroy(server->last_values);
+    memset(&server->group_cipher, 0, sizeof(server->group_cipher));
     free(server);
 }
 
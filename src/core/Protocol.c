@@ -0,0 +1,172 @@
+#include "core/Protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "utils/safe_io.h"
+
+struct FrameReader {
+    uint8_t buffer[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    size_t start;
+    size_t end;
+};
+
+void Protocol_write_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (uint8_t) (value >> (24 - 8 * i));
+    }
+}
+
+uint32_t Protocol_read_u32(const uint8_t *in) {
+    return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | (uint32_t) in[3];
+}
+
+void Protocol_write_u64(uint8_t *out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (uint8_t) (value >> (56 - 8 * i));
+    }
+}
+
+uint64_t Protocol_read_u64(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+void Protocol_encode_header(const FrameHeader *header, uint8_t *out) {
+    out[0] = header->type;
+    out[1] = header->flags;
+    out[2] = 0;
+    out[3] = 0;
+    Protocol_write_u32(out + 4, header->length);
+    Protocol_write_u64(out + 8, header->sequence);
+}
+
+void Protocol_decode_header(const uint8_t *in, FrameHeader *header) {
+    header->type = in[0];
+    header->flags = in[1];
+    header->length = Protocol_read_u32(in + 4);
+    header->sequence = Protocol_read_u64(in + 8);
+}
+
+ssize_t Protocol_send_frame(int file_descriptor, const FrameHeader *header, const void *payload, int *error_flag) {
+    uint8_t encoded_header[FRAME_HEADER_SIZE];
+    Protocol_encode_header(header, encoded_header);
+
+    struct iovec iov[2];
+    iov[0].iov_base = encoded_header;
+    iov[0].iov_len = sizeof(encoded_header);
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = header->length;
+
+    return safe_writev(file_descriptor, iov, header->length > 0 ? 2 : 1, error_flag);
+}
+
+size_t Protocol_encode_frame(uint8_t type, uint64_t sequence, CipherState *state, const void *payload, size_t length,
+                             uint8_t *out, int *error_flag) {
+    return Protocol_encode_flagged_frame(type, 0, sequence, state, payload, length, out, error_flag);
+}
+
+size_t Protocol_encode_flagged_frame(uint8_t type, uint8_t flags, uint64_t sequence, CipherState *state,
+                                     const void *payload, size_t length, uint8_t *out, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    FrameHeader header;
+    header.type = type;
+    header.sequence = sequence;
+    header.flags = state ? flags | FRAME_FLAG_SEALED : flags;
+    header.length = (uint32_t) (state ? length + CRYPTO_SEAL_OVERHEAD : length);
+
+    if (header.length > FRAME_MAX_PAYLOAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    Protocol_encode_header(&header, out);
+    if (!state) {
+        memcpy(out + FRAME_HEADER_SIZE, payload, length);
+        return FRAME_HEADER_SIZE + length;
+    }
+
+    crypto_seal(state, out, FRAME_HEADER_SIZE, payload, length, out + FRAME_HEADER_SIZE, error_flag);
+    return FRAME_HEADER_SIZE + header.length;
+}
+
+size_t Protocol_open_frame(const FrameHeader *header, const uint8_t *payload, const uint8_t key[CRYPTO_KEY_SIZE],
+                           uint8_t *out, uint64_t *nonce_counter, int *error_flag) {
+    uint8_t aad[FRAME_HEADER_SIZE];
+    Protocol_encode_header(header, aad);
+    return crypto_open(key, aad, sizeof(aad), payload, header->length, out, nonce_counter, error_flag);
+}
+
+FrameReader *FrameReader_create(int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    FrameReader *reader = calloc(1, sizeof(FrameReader));
+    if (!reader) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+    return reader;
+}
+
+void FrameReader_destroy(FrameReader *reader) {
+    free(reader);
+}
+
+ssize_t FrameReader_fill(FrameReader *reader, int file_descriptor, int flags, int *error_flag) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    ssize_t bytes_read = safe_recv(file_descriptor, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end, flags, error_flag);
+    if (bytes_read > 0) {
+        reader->end += (size_t) bytes_read;
+    }
+    return bytes_read;
+}
+
+void FrameReader_reset(FrameReader *reader) {
+    reader->start = 0;
+    reader->end = 0;
+}
+
+int FrameReader_next(FrameReader *reader, FrameHeader *header, const uint8_t **payload, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    size_t available = reader->end - reader->start;
+    if (available < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+
+    Protocol_decode_header(reader->buffer + reader->start, header);
+    if (header->length > FRAME_MAX_PAYLOAD) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    if (available < FRAME_HEADER_SIZE + header->length) {
+        return 0;
+    }
+
+    *payload = reader->buffer + reader->start + FRAME_HEADER_SIZE;
+    reader->start += FRAME_HEADER_SIZE + header->length;
+    return 1;
+}
@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include "core/Replay.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "core/Client.h"
+#include "core/Protocol.h"
+#include "core/Trace.h"
+#include "utils/clock.h"
+
+enum {
+    MAX_EVENTS = 64,
+    MAX_REPLAY_STREAMS = 4,   // the relay's per-client limit
+    WINDOW_WAIT_MS = 100,
+    DRAIN_MS = 500,           // collects broadcasts still in flight after the last record
+    SERVER_IP_LENGTH = 64
+};
+
+// outgoing stream of a replayed connection; DATA records wait for relay window like a real sender
+typedef struct {
+    uint32_t stream_id;
+    uint64_t window;
+    int is_open;
+} ReplayStream;
+
+typedef struct ReplayConnection ReplayConnection;
+
+struct ReplayConnection {
+    uint32_t connection_id; // as recorded
+    Client *client;
+    int is_closed;          // connection lost, freed after the current batch of events
+    ReplayStream streams[MAX_REPLAY_STREAMS];
+    Replay *replay;
+    ReplayConnection *next;
+};
+
+struct Replay {
+    TraceReader *reader;
+    char server_ip[SERVER_IP_LENGTH];
+    int port;
+    double speed;
+    int epoll_file_descriptor;
+    ReplayConnection *connections;
+    uint64_t *lags;
+    size_t lag_count;
+    size_t lag_capacity;
+    ReplayReport report;
+};
+
+Replay *Replay_create(const char *trace_path, const char *server_ip, int port, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!trace_path || !server_ip || strlen(server_ip) >= SERVER_IP_LENGTH) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    Replay *replay = calloc(1, sizeof(Replay));
+    if (!replay) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    replay->reader = TraceReader_create(trace_path, error_flag);
+    if (!replay->reader) {
+        free(replay);
+        return NULL;
+    }
+
+    replay->epoll_file_descriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (replay->epoll_file_descriptor < 0) {
+        TraceReader_destroy(replay->reader);
+        free(replay);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    strcpy(replay->server_ip, server_ip);
+    replay->port = port;
+    replay->speed = 1.0;
+    return replay;
+}
+
+void Replay_free_connection(ReplayConnection *connection) {
+    Client_destroy(connection->client);
+    free(connection);
+}
+
+void Replay_destroy(Replay *replay) {
+    if (!replay) {
+        return;
+    }
+
+    while (replay->connections) {
+        ReplayConnection *next = replay->connections->next;
+        Replay_free_connection(replay->connections);
+        replay->connections = next;
+    }
+    close(replay->epoll_file_descriptor);
+    TraceReader_destroy(replay->reader);
+    free(replay->lags);
+    free(replay);
+}
+
+void Replay_set_speed(Replay *replay, double speed) {
+    if (replay && speed >= 0) {
+        replay->speed = speed;
+    }
+}
+
+ReplayConnection *Replay_find_connection(Replay *replay, uint32_t connection_id) {
+    for (ReplayConnection *connection = replay->connections; connection; connection = connection->next) {
+        if (connection->connection_id == connection_id && !connection->is_closed) {
+            return connection;
+        }
+    }
+    return NULL;
+}
+
+ReplayStream *Replay_find_stream(ReplayConnection *connection, uint32_t stream_id) {
+    for (int i = 0; i < MAX_REPLAY_STREAMS; ++i) {
+        if (connection->streams[i].is_open && connection->streams[i].stream_id == stream_id) {
+            return &connection->streams[i];
+        }
+    }
+    return NULL;
+}
+
+void Replay_close_connection(ReplayConnection *connection) {
+    if (!connection->is_closed) {
+        epoll_ctl(connection->replay->epoll_file_descriptor, EPOLL_CTL_DEL,
+                  Client_get_file_descriptor(connection->client), NULL);
+        connection->is_closed = 1;
+    }
+}
+
+void Replay_free_closed_connections(Replay *replay) {
+    ReplayConnection **link = &replay->connections;
+    while (*link) {
+        ReplayConnection *connection = *link;
+        if (connection->is_closed) {
+            *link = connection->next;
+            Replay_free_connection(connection);
+        } else {
+            link = &connection->next;
+        }
+    }
+}
+
+void Replay_handle_frame(void *context, uint8_t type, uint64_t sequence, const uint8_t *payload, size_t length) {
+    (void) sequence;
+    ReplayConnection *connection = context;
+    ++connection->replay->report.frames_received;
+
+    if (type == FRAME_WINDOW && length >= WINDOW_PAYLOAD_SIZE) {
+        ReplayStream *stream = Replay_find_stream(connection, Protocol_read_u32(payload));
+        if (stream) {
+            stream->window += Protocol_read_u32(payload + STREAM_ID_SIZE);
+        }
+    }
+}
+
+// reads whatever the relay sent to the replayed connections, waiting up to timeout_ms
+void Replay_pump(Replay *replay, int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(replay->epoll_file_descriptor, events, MAX_EVENTS, timeout_ms);
+    if (count < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        ReplayConnection *connection = events[i].data.ptr;
+        if (connection->is_closed) {
+            continue;
+        }
+
+        int receive_error = 0;
+        Client_receive(connection->client, Replay_handle_frame, connection, &receive_error);
+        if (receive_error) {
+            Replay_close_connection(connection);
+        }
+    }
+    Replay_free_closed_connections(replay);
+}
+
+void Replay_wait_until(Replay *replay, uint64_t deadline_ns) {
+    uint64_t now = clock_monotonic_ns();
+    do {
+        // below a millisecond epoll cannot sleep precisely, so it spins
+        uint64_t remaining = deadline_ns > now ? deadline_ns - now : 0;
+        Replay_pump(replay, (int) (remaining / 1000000));
+        now = clock_monotonic_ns();
+    } while (now < deadline_ns);
+}
+
+void Replay_open_connection(Replay *replay, uint32_t connection_id) {
+    ++replay->report.connections;
+
+    int create_error = 0;
+    ReplayConnection *connection = calloc(1, sizeof(ReplayConnection));
+    Client *client = connection ? Client_create(replay->server_ip, replay->port, &create_error) : NULL;
+    if (client) {
+        Client_connect(client, &create_error);
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    if (!client || create_error
+        || epoll_ctl(replay->epoll_file_descriptor, EPOLL_CTL_ADD, Client_get_file_descriptor(client), &event) < 0) {
+        ++replay->report.failed_connections;
+        Client_destroy(client);
+        free(connection);
+        return;
+    }
+
+    connection->connection_id = connection_id;
+    connection->client = client;
+    connection->replay = replay;
+    connection->next = replay->connections;
+    replay->connections = connection;
+}
+
+void Replay_record_lag(Replay *replay, uint64_t lag_ns) {
+    if (replay->lag_count == replay->lag_capacity) {
+        size_t capacity = replay->lag_capacity ? replay->lag_capacity * 2 : 1024;
+        uint64_t *lags = realloc(replay->lags, capacity * sizeof(uint64_t));
+        if (!lags) {
+            return; // the report just covers fewer frames
+        }
+        replay->lags = lags;
+        replay->lag_capacity = capacity;
+    }
+    replay->lags[replay->lag_count++] = lag_ns;
+}
+
+// stream frames go through the same window bookkeeping as a real sender
+// or the relay would drop the connection
+int Replay_wait_for_window(Replay *replay, uint32_t connection_id, const TraceRecord *record, const uint8_t *payload) {
+    ReplayConnection *connection = Replay_find_connection(replay, connection_id);
+    if (!connection || record->length < STREAM_ID_SIZE) {
+        return connection != NULL;
+    }
+
+    uint32_t stream_id = Protocol_read_u32(payload);
+    if (record->frame_type == FRAME_STREAM_START && !Replay_find_stream(connection, stream_id)) {
+        for (int i = 0; i < MAX_REPLAY_STREAMS; ++i) {
+            if (!connection->streams[i].is_open) {
+                connection->streams[i] = (ReplayStream) {stream_id, 0, 1};
+                break;
+            }
+        }
+    }
+
+    if (record->frame_type == FRAME_STREAM_DATA) {
+        uint64_t chunk_length = record->length - STREAM_ID_SIZE;
+        ReplayStream *stream = Replay_find_stream(connection, stream_id);
+        while (stream && stream->window < chunk_length) {
+            Replay_pump(replay, WINDOW_WAIT_MS);
+            connection = Replay_find_connection(replay, connection_id);
+            if (!connection) {
+                return 0;
+            }
+            stream = Replay_find_stream(connection, stream_id);
+        }
+        if (stream) {
+            stream->window -= chunk_length;
+        }
+    }
+
+    if (record->frame_type == FRAME_STREAM_END) {
+        ReplayStream *stream = Replay_find_stream(connection, stream_id);
+        if (stream) {
+            stream->is_open = 0;
+        }
+    }
+    return 1;
+}
+
+void Replay_send_frame(Replay *replay, const TraceRecord *record, const uint8_t *payload, uint64_t due_ns) {
+    // the replayed connection never joined the group and receives different sequences,
+    // resending these would stop its TCP delivery or acknowledge what it never got
+    if (record->frame_type == FRAME_SUBSCRIBE || record->frame_type == FRAME_NACK || record->frame_type == FRAME_ACK) {
+        ++replay->report.frames_ignored;
+        return;
+    }
+
+    if (!Replay_wait_for_window(replay, record->connection_id, record, payload)) {
+        ++replay->report.frames_skipped;
+        return;
+    }
+
+    ReplayConnection *connection = Replay_find_connection(replay, record->connection_id);
+    if (replay->speed > 0) {
+        uint64_t now = clock_monotonic_ns();
+        Replay_record_lag(replay, now > due_ns ? now - due_ns : 0);
+    }
+
+    int send_error = 0;
+    Client_send_frame(connection->client, record->frame_type, payload, record->length, &send_error);
+    if (send_error) {
+        ++replay->report.frames_skipped;
+        Replay_close_connection(connection);
+        return;
+    }
+    ++replay->report.frames_sent;
+    replay->report.bytes_sent += record->length;
+}
+
+int Replay_compare_lags(const void *left, const void *right) {
+    uint64_t a = *(const uint64_t *) left;
+    uint64_t b = *(const uint64_t *) right;
+    return (a > b) - (a < b);
+}
+
+void Replay_summarize_lags(Replay *replay) {
+    if (replay->lag_count == 0) {
+        return;
+    }
+
+    qsort(replay->lags, replay->lag_count, sizeof(uint64_t), Replay_compare_lags);
+    uint64_t total = 0;
+    for (size_t i = 0; i < replay->lag_count; ++i) {
+        total += replay->lags[i];
+    }
+    replay->report.lag_mean_ns = total / replay->lag_count;
+    replay->report.lag_p50_ns = replay->lags[replay->lag_count / 2];
+    replay->report.lag_p99_ns = replay->lags[(replay->lag_count * 99) / 100];
+    replay->report.lag_max_ns = replay->lags[replay->lag_count - 1];
+}
+
+void Replay_run(Replay *replay, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!replay) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return;
+    }
+
+    TraceRecord record;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+    uint64_t start = clock_monotonic_ns();
+    int is_first = 1;
+    int read_error = 0;
+
+    while (TraceReader_next(replay->reader, &record, payload, &read_error)) {
+        if (is_first) {
+            first_timestamp = record.timestamp_ns;
+            is_first = 0;
+        }
+        last_timestamp = record.timestamp_ns;
+
+        uint64_t due = start;
+        if (replay->speed > 0) {
+            due += (uint64_t) ((double) (record.timestamp_ns - first_timestamp) / replay->speed);
+            Replay_wait_until(replay, due);
+        } else {
+            Replay_pump(replay, 0); // keep the relay's queues to us short
+        }
+
+        if (record.event == TRACE_CONNECT) {
+            Replay_open_connection(replay, record.connection_id);
+        } else if (record.event == TRACE_DISCONNECT) {
+            ReplayConnection *connection = Replay_find_connection(replay, record.connection_id);
+            if (connection) {
+                Replay_close_connection(connection);
+                Replay_free_closed_connections(replay);
+            }
+        } else if (record.event == TRACE_FRAME) {
+            Replay_send_frame(replay, &record, payload, due);
+        }
+    }
+    replay->report.replay_duration_ns = clock_monotonic_ns() - start;
+    replay->report.recorded_duration_ns = last_timestamp - first_timestamp;
+
+    if (read_error) {
+        fprintf(stderr, "Trace ends with a truncated record, replayed up to it\n");
+    }
+
+    Replay_wait_until(replay, clock_monotonic_ns() + (uint64_t) DRAIN_MS * 1000000);
+    Replay_summarize_lags(replay);
+}
+
+void Replay_get_report(const Replay *replay, ReplayReport *report) {
+    if (replay && report) {
+        *report = replay->report;
+    }
+}
@@ -0,0 +1,160 @@
+#include "core/Trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/Protocol.h"
+
+static const char TRACE_MAGIC[8] = {'M', 'R', 'T', 'R', 'A', 'C', 'E', '1'};
+
+enum {
+    TRACE_BUFFER_SIZE = 1 << 20
+};
+
+struct TraceWriter {
+    FILE *file;
+};
+
+struct TraceReader {
+    FILE *file;
+};
+
+TraceWriter *TraceWriter_create(const char *path, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    TraceWriter *writer = malloc(sizeof(TraceWriter));
+    if (!writer) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    writer->file = fopen(path, "wbe");
+    if (!writer->file) {
+        perror("fopen");
+        free(writer);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    // records are small and frequent, let stdio batch them into large writes
+    setvbuf(writer->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    if (fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, writer->file) != 1) {
+        fclose(writer->file);
+        free(writer);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+    return writer;
+}
+
+void TraceWriter_destroy(TraceWriter *writer) {
+    if (!writer) {
+        return;
+    }
+
+    if (fclose(writer->file) != 0) {
+        perror("fclose");
+    }
+    free(writer);
+}
+
+void TraceWriter_write(TraceWriter *writer, const TraceRecord *record, const void *payload, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    uint8_t header[TRACE_RECORD_HEADER_SIZE];
+    Protocol_write_u64(header, record->timestamp_ns);
+    Protocol_write_u32(header + 8, record->connection_id);
+    header[12] = record->event;
+    header[13] = record->frame_type;
+    Protocol_write_u32(header + 14, record->length);
+
+    if (fwrite(header, sizeof(header), 1, writer->file) != 1
+        || (record->length > 0 && fwrite(payload, record->length, 1, writer->file) != 1)) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+    }
+}
+
+TraceReader *TraceReader_create(const char *path, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    TraceReader *reader = malloc(sizeof(TraceReader));
+    if (!reader) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    reader->file = fopen(path, "rbe");
+    if (!reader->file || fread(magic, sizeof(magic), 1, reader->file) != 1
+        || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        if (reader->file) {
+            fclose(reader->file);
+        }
+        free(reader);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    setvbuf(reader->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    return reader;
+}
+
+void TraceReader_destroy(TraceReader *reader) {
+    if (!reader) {
+        return;
+    }
+
+    fclose(reader->file);
+    free(reader);
+}
+
+int TraceReader_next(TraceReader *reader, TraceRecord *record, uint8_t *payload, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    uint8_t header[TRACE_RECORD_HEADER_SIZE];
+    size_t header_read = fread(header, 1, sizeof(header), reader->file);
+    if (header_read == 0 && feof(reader->file)) {
+        return 0;
+    }
+
+    int is_valid = header_read == sizeof(header);
+    if (is_valid) {
+        record->timestamp_ns = Protocol_read_u64(header);
+        record->connection_id = Protocol_read_u32(header + 8);
+        record->event = header[12];
+        record->frame_type = header[13];
+        record->length = Protocol_read_u32(header + 14);
+        is_valid = record->length <= FRAME_MAX_PAYLOAD
+                   && (record->length == 0 || fread(payload, record->length, 1, reader->file) == 1);
+    }
+
+    if (!is_valid) {
+        // truncated or corrupt, e.g. the relay was killed mid-write
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+    return 1;
+}
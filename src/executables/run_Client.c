@@ -1,7 +1,11 @@
+#define _GNU_SOURCE
+
 #include "executables/run_Client.h"
 
 #include <arpa/inet.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/select.h>
@@ -11,18 +15,56 @@
 #include "core/Client.h"
 #include "utils/parse.h"
 
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <server_ip> <port>\n", program);
+    fprintf(stderr, "  --download-dir=DIR  save files sent by other clients into DIR (default: discard them)\n");
+    fprintf(stderr, "  --multicast         receive broadcasts through the relay's multicast group if it has one\n");
+    fprintf(stderr, "  --compress          accept compressed broadcasts if the relay offers compression\n");
+}
+
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <server_ip> <port>\n", argv[0]);
+    static const struct option options[] = {
+        {"download-dir", required_argument, NULL, 'd'},
+        {"multicast", no_argument, NULL, 'm'},
+        {"compress", no_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+
+    const char *download_directory = NULL;
+    int is_multicast = 0;
+    int is_compressed = 0;
+    int option;
+    while ((option = getopt_long(argc, argv, "d:mc", options, NULL)) != -1) {
+        switch (option) {
+            case 'd':
+                download_directory = optarg;
+                break;
+            case 'm':
+                is_multicast = 1;
+                break;
+            case 'c':
+                is_compressed = 1;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    const char *server_ip = argv[1];
+    // a peer that went away must surface as a write error, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *server_ip = argv[optind];
 
     int parse_error = 0;
-    int port = parse_port(argv[2], &parse_error);
+    int port = parse_port(argv[optind + 1], &parse_error);
     if (parse_error != 0) {
-        fprintf(stderr, "Invalid port: %s\n", argv[2]);
+        fprintf(stderr, "Invalid port: %s\n", argv[optind + 1]);
         return EXIT_FAILURE;
     }
 
@@ -33,6 +75,23 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    if (download_directory) {
+        int directory_error = 0;
+        Client_set_download_directory(client, download_directory, &directory_error);
+        if (directory_error != 0) {
+            fprintf(stderr, "Failed to set download directory\n");
+            Client_destroy(client);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (is_multicast) {
+        Client_enable_multicast(client);
+    }
+    if (is_compressed) {
+        Client_enable_compression(client);
+    }
+
     int connect_error = 0;
     Client_connect(client, &connect_error);
     if (connect_error != 0) {
@@ -1,19 +1,170 @@
+#define _GNU_SOURCE
+
 #include "executables/run_ProcessingServer.h"
 
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/ProcessingServer.h"
 #include "utils/parse.h"
 
+enum {
+    DEFAULT_SPIN_US = 50000,
+    DEFAULT_COMPRESSION_THRESHOLD = 64,
+    DEFAULT_RELIABLE_CAPACITY = 65536
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <port>\n", program);
+    fprintf(stderr, "  --encrypt                   seal relayed messages with a group key\n");
+    fprintf(stderr, "  --zerocopy-threshold=BYTES  send messages of at least BYTES with MSG_ZEROCOPY\n");
+    fprintf(stderr, "  --busy-poll                 low-latency mode: poll without blocking while traffic flows\n");
+    fprintf(stderr, "  --spin-us=USECS             how long busy-poll keeps spinning after the last event (default %u)\n", DEFAULT_SPIN_US);
+    fprintf(stderr, "  --cpu=CPU                   pin the event loop to CPU in busy-poll mode\n");
+    fprintf(stderr, "  --multicast=GROUP:PORT      publish broadcasts to a multicast group, clients repair losses over TCP\n");
+    fprintf(stderr, "  --multicast-if=ADDR         send multicast from the interface with address ADDR\n");
+    fprintf(stderr, "  --capture=FILE              record inbound traffic to FILE for run_Replay\n");
+    fprintf(stderr, "  --compress[=BYTES]          compress texts of at least BYTES for clients that accept it (default %u)\n",
+            DEFAULT_COMPRESSION_THRESHOLD);
+    fprintf(stderr, "  --overload-lag-us=USECS     shed load step by step once the event loop lags USECS behind\n");
+    fprintf(stderr, "  --reliable[=MESSAGES]       at-least-once delivery, keep up to MESSAGES unacknowledged (default %u)\n",
+            DEFAULT_RELIABLE_CAPACITY);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    static const struct option options[] = {
+        {"encrypt", no_argument, NULL, 'e'},
+        {"zerocopy-threshold", required_argument, NULL, 'z'},
+        {"busy-poll", no_argument, NULL, 'b'},
+        {"spin-us", required_argument, NULL, 's'},
+        {"cpu", required_argument, NULL, 'c'},
+        {"capture", required_argument, NULL, 'C'},
+        {"multicast", required_argument, NULL, 'm'},
+        {"multicast-if", required_argument, NULL, 'i'},
+        {"compress", optional_argument, NULL, 'Z'},
+        {"overload-lag-us", required_argument, NULL, 'o'},
+        {"reliable", optional_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+
+    // a peer that went away must surface as a write error, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    int is_encrypted = 0;
+    size_t zerocopy_threshold = 0;
+    int is_busy_poll = 0;
+    size_t spin_us = DEFAULT_SPIN_US;
+    int is_spin_set = 0;
+    int cpu = -1;
+    const char *capture_path = NULL;
+    char *multicast_group = NULL;
+    int multicast_port = 0;
+    const char *multicast_interface = NULL;
+    int is_compressing = 0;
+    size_t compression_threshold = DEFAULT_COMPRESSION_THRESHOLD;
+    size_t overload_lag_us = 0;
+    int is_reliable = 0;
+    size_t reliable_capacity = DEFAULT_RELIABLE_CAPACITY;
+    int option;
+    int option_error = 0;
+    while ((option = getopt_long(argc, argv, "ez:bs:c:C:m:i:Z::o:r::", options, NULL)) != -1) {
+        switch (option) {
+            case 'e':
+                is_encrypted = 1;
+                break;
+            case 'z':
+                zerocopy_threshold = parse_size(optarg, &option_error);
+                if (option_error) {
+                    fprintf(stderr, "Invalid zero-copy threshold: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                is_busy_poll = 1;
+                break;
+            case 's':
+                spin_us = parse_size(optarg, &option_error);
+                if (option_error || spin_us > UINT_MAX) {
+                    fprintf(stderr, "Invalid spin duration: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                is_spin_set = 1;
+                break;
+            case 'c':
+                cpu = (int) parse_size(optarg, &option_error);
+                if (option_error || cpu < 0) {
+                    fprintf(stderr, "Invalid CPU: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'C':
+                capture_path = optarg;
+                break;
+            case 'm': {
+                char *separator = strrchr(optarg, ':');
+                if (separator) {
+                    *separator = '\0';
+                    multicast_port = parse_port(separator + 1, &option_error);
+                }
+                if (!separator || option_error) {
+                    fprintf(stderr, "Invalid multicast group, expected GROUP:PORT: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                multicast_group = optarg;
+                break;
+            }
+            case 'i':
+                multicast_interface = optarg;
+                break;
+            case 'Z':
+                is_compressing = 1;
+                if (optarg) {
+                    compression_threshold = parse_size(optarg, &option_error);
+                    if (option_error) {
+                        fprintf(stderr, "Invalid compression threshold: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            case 'o':
+                overload_lag_us = parse_size(optarg, &option_error);
+                if (option_error || overload_lag_us == 0 || overload_lag_us > UINT_MAX) {
+                    fprintf(stderr, "Invalid overload lag: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                is_reliable = 1;
+                if (optarg) {
+                    reliable_capacity = parse_size(optarg, &option_error);
+                    if (option_error) {
+                        fprintf(stderr, "Invalid reliable capacity: %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (!is_busy_poll && (cpu >= 0 || is_spin_set)) {
+        fprintf(stderr, "--cpu and --spin-us only apply with --busy-poll\n");
+        return EXIT_FAILURE;
+    }
+
+    if (argc - optind != 1) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
     int parse_error = 0;
-    int port = parse_port(argv[1], &parse_error);
+    int port = parse_port(argv[optind], &parse_error);
     
     if (parse_error != 0) {
         fprintf(stderr, "Invalid port\n");
@@ -28,7 +179,64 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    printf("Server listening on port %d\n", port);
+    if (is_encrypted) {
+        int encryption_error = 0;
+        ProcessingServer_enable_encryption(server, &encryption_error);
+        if (encryption_error) {
+            fprintf(stderr, "Failed to set up encryption\n");
+            ProcessingServer_destroy(server);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ProcessingServer_set_zerocopy_threshold(server, zerocopy_threshold);
+    if (is_compressing) {
+        ProcessingServer_enable_compression(server, compression_threshold);
+    }
+    if (is_reliable) {
+        int reliable_error = 0;
+        ProcessingServer_enable_reliable_delivery(server, reliable_capacity, &reliable_error);
+        if (reliable_error) {
+            fprintf(stderr, "Failed to set up reliable delivery for %zu messages\n", reliable_capacity);
+            ProcessingServer_destroy(server);
+            return EXIT_FAILURE;
+        }
+    }
+    if (overload_lag_us) {
+        ProcessingServer_enable_overload_protection(server, (unsigned int) overload_lag_us, NULL);
+    }
+
+    if (multicast_group) {
+        int multicast_error = 0;
+        ProcessingServer_enable_multicast(server, multicast_group, multicast_port, multicast_interface, &multicast_error);
+        if (multicast_error) {
+            fprintf(stderr, "Failed to set up multicast group %s:%d\n", multicast_group, multicast_port);
+            ProcessingServer_destroy(server);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (capture_path) {
+        int capture_error = 0;
+        ProcessingServer_enable_capture(server, capture_path, &capture_error);
+        if (capture_error) {
+            fprintf(stderr, "Failed to open capture file %s\n", capture_path);
+            ProcessingServer_destroy(server);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (is_busy_poll) {
+        int busy_poll_error = 0;
+        ProcessingServer_enable_busy_poll(server, cpu, (unsigned int) spin_us, &busy_poll_error);
+        if (busy_poll_error) {
+            fprintf(stderr, "Invalid busy-poll settings\n");
+            ProcessingServer_destroy(server);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Server listening on port %d%s\n", port, is_encrypted ? " (encrypted)" : "");
     
     int error_flag = 0;
     ProcessingServer_run(server, &error_flag);
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include "executables/run_Replay.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "core/Replay.h"
+#include "utils/parse.h"
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] <trace> <server_ip> <port>\n", program);
+    fprintf(stderr, "  --speed=FACTOR  replay FACTOR times faster than recorded (default 1)\n");
+    fprintf(stderr, "  --max-speed     send every record as fast as possible\n");
+}
+
+static double per_second(uint64_t count, uint64_t duration_ns) {
+    return duration_ns ? (double) count * 1e9 / (double) duration_ns : 0;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"max-speed", no_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0}
+    };
+
+    double speed = 1.0;
+    int option;
+    int option_error = 0;
+    while ((option = getopt_long(argc, argv, "s:m", options, NULL)) != -1) {
+        switch (option) {
+            case 's':
+                speed = parse_double(optarg, &option_error);
+                if (option_error || speed == 0) {
+                    fprintf(stderr, "Invalid speed: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                speed = 0;
+                break;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 3) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // a peer that went away must surface as a write error, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    int parse_error = 0;
+    int port = parse_port(argv[optind + 2], &parse_error);
+    if (parse_error != 0) {
+        fprintf(stderr, "Invalid port: %s\n", argv[optind + 2]);
+        return EXIT_FAILURE;
+    }
+
+    int create_error = 0;
+    Replay *replay = Replay_create(argv[optind], argv[optind + 1], port, &create_error);
+    if (create_error != 0) {
+        fprintf(stderr, "Failed to open trace %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    Replay_set_speed(replay, speed);
+
+    int run_error = 0;
+    Replay_run(replay, &run_error);
+
+    ReplayReport report;
+    Replay_get_report(replay, &report);
+    Replay_destroy(replay);
+
+    double recorded_s = (double) report.recorded_duration_ns / 1e9;
+    double replay_s = (double) report.replay_duration_ns / 1e9;
+    printf("connections:   %llu opened, %llu failed\n",
+           (unsigned long long) report.connections, (unsigned long long) report.failed_connections);
+    printf("frames:        %llu sent (%llu bytes), %llu skipped, %llu ignored, %llu received\n",
+           (unsigned long long) report.frames_sent, (unsigned long long) report.bytes_sent,
+           (unsigned long long) report.frames_skipped, (unsigned long long) report.frames_ignored,
+           (unsigned long long) report.frames_received);
+    printf("duration:      %.3f s recorded, %.3f s replayed\n", recorded_s, replay_s);
+    printf("throughput:    %.1f frames/s, %.3f MB/s (recorded %.1f frames/s)\n",
+           per_second(report.frames_sent, report.replay_duration_ns),
+           per_second(report.bytes_sent, report.replay_duration_ns) / 1e6,
+           per_second(report.frames_sent + report.frames_skipped + report.frames_ignored,
+                      report.recorded_duration_ns));
+    if (speed > 0) {
+        printf("lag (us):      mean %.1f, p50 %.1f, p99 %.1f, max %.1f\n",
+               (double) report.lag_mean_ns / 1e3, (double) report.lag_p50_ns / 1e3,
+               (double) report.lag_p99_ns / 1e3, (double) report.lag_max_ns / 1e3);
+    }
+
+    return run_error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+#define _GNU_SOURCE
+
+#include "utils/clock.h"
+
+#include <time.h>
+
+uint64_t clock_monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+uint64_t clock_monotonic_ms(void) {
+    return clock_monotonic_ns() / 1000000ULL;
+}
+
+uint64_t clock_thread_cpu_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
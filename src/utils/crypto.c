@@ -0,0 +1,185 @@
+#include "utils/crypto.h"
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include <string.h>
+
+static void set_error(int *error_flag) {
+    if (error_flag) {
+        *error_flag = 1;
+    }
+}
+
+static void build_nonce(uint64_t counter, uint8_t nonce[CRYPTO_NONCE_SIZE]) {
+    memset(nonce, 0, CRYPTO_NONCE_SIZE);
+    for (int i = 0; i < 8; ++i) {
+        nonce[CRYPTO_NONCE_SIZE - 1 - i] = (uint8_t) (counter >> (8 * i));
+    }
+}
+
+static uint64_t parse_nonce(const uint8_t nonce[CRYPTO_NONCE_SIZE]) {
+    uint64_t counter = 0;
+    for (int i = CRYPTO_NONCE_SIZE - 8; i < CRYPTO_NONCE_SIZE; ++i) {
+        counter = (counter << 8) | nonce[i];
+    }
+    return counter;
+}
+
+void crypto_random_bytes(void *buffer, size_t count, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (RAND_bytes(buffer, (int) count) != 1) {
+        set_error(error_flag);
+    }
+}
+
+void crypto_generate_keypair(uint8_t private_key[CRYPTO_KEY_SIZE], uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE], int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    EVP_PKEY *key = NULL;
+    EVP_PKEY_CTX *context = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    size_t private_length = CRYPTO_KEY_SIZE;
+    size_t public_length = CRYPTO_PUBLIC_KEY_SIZE;
+
+    if (!context
+        || EVP_PKEY_keygen_init(context) != 1
+        || EVP_PKEY_keygen(context, &key) != 1
+        || EVP_PKEY_get_raw_private_key(key, private_key, &private_length) != 1
+        || EVP_PKEY_get_raw_public_key(key, public_key, &public_length) != 1) {
+        set_error(error_flag);
+    }
+
+    EVP_PKEY_free(key);
+    EVP_PKEY_CTX_free(context);
+}
+
+static int hkdf(const uint8_t *secret, size_t secret_length, const uint8_t *salt, size_t salt_length,
+                const char *info, uint8_t out[CRYPTO_KEY_SIZE]) {
+    EVP_PKEY_CTX *context = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    size_t out_length = CRYPTO_KEY_SIZE;
+
+    int ok = context
+        && EVP_PKEY_derive_init(context) == 1
+        && EVP_PKEY_CTX_set_hkdf_md(context, EVP_sha256()) == 1
+        && EVP_PKEY_CTX_set1_hkdf_salt(context, salt, (int) salt_length) == 1
+        && EVP_PKEY_CTX_set1_hkdf_key(context, secret, (int) secret_length) == 1
+        && EVP_PKEY_CTX_add1_hkdf_info(context, (const unsigned char *) info, (int) strlen(info)) == 1
+        && EVP_PKEY_derive(context, out, &out_length) == 1;
+
+    EVP_PKEY_CTX_free(context);
+    return ok;
+}
+
+void crypto_derive_session_keys(const uint8_t private_key[CRYPTO_KEY_SIZE],
+                                const uint8_t peer_public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                                int is_server,
+                                uint8_t client_to_server_key[CRYPTO_KEY_SIZE],
+                                uint8_t server_to_client_key[CRYPTO_KEY_SIZE],
+                                int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    EVP_PKEY *own = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, private_key, CRYPTO_KEY_SIZE);
+    EVP_PKEY *peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    EVP_PKEY_CTX *context = own ? EVP_PKEY_CTX_new(own, NULL) : NULL;
+
+    uint8_t shared[CRYPTO_KEY_SIZE];
+    size_t shared_length = sizeof(shared);
+
+    // salt binds both public keys in client, server order
+    uint8_t salt[2 * CRYPTO_PUBLIC_KEY_SIZE];
+    size_t own_length = CRYPTO_PUBLIC_KEY_SIZE;
+    uint8_t *own_public = is_server ? salt + CRYPTO_PUBLIC_KEY_SIZE : salt;
+    uint8_t *peer_public = is_server ? salt : salt + CRYPTO_PUBLIC_KEY_SIZE;
+    memcpy(peer_public, peer_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    int ok = own && peer && context
+        && EVP_PKEY_get_raw_public_key(own, own_public, &own_length) == 1
+        && EVP_PKEY_derive_init(context) == 1
+        && EVP_PKEY_derive_set_peer(context, peer) == 1
+        && EVP_PKEY_derive(context, shared, &shared_length) == 1
+        && hkdf(shared, shared_length, salt, sizeof(salt), "message-relay c2s", client_to_server_key)
+        && hkdf(shared, shared_length, salt, sizeof(salt), "message-relay s2c", server_to_client_key);
+
+    if (!ok) {
+        set_error(error_flag);
+    }
+
+    memset(shared, 0, sizeof(shared));
+    EVP_PKEY_CTX_free(context);
+    EVP_PKEY_free(peer);
+    EVP_PKEY_free(own);
+}
+
+size_t crypto_seal(CipherState *state, const uint8_t *aad, size_t aad_length,
+                   const uint8_t *plaintext, size_t length, uint8_t *out, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    uint8_t *nonce = out;
+    uint8_t *ciphertext = out + CRYPTO_NONCE_SIZE;
+    uint8_t *tag = ciphertext + length;
+    build_nonce(state->nonce_counter++, nonce);
+
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    int chunk = 0;
+    int ok = context
+        && EVP_EncryptInit_ex(context, EVP_chacha20_poly1305(), NULL, state->key, nonce) == 1
+        && (aad_length == 0 || EVP_EncryptUpdate(context, NULL, &chunk, aad, (int) aad_length) == 1)
+        && (length == 0 || EVP_EncryptUpdate(context, ciphertext, &chunk, plaintext, (int) length) == 1)
+        && EVP_EncryptFinal_ex(context, ciphertext + length, &chunk) == 1
+        && EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_AEAD_GET_TAG, CRYPTO_TAG_SIZE, tag) == 1;
+
+    EVP_CIPHER_CTX_free(context);
+    if (!ok) {
+        set_error(error_flag);
+        return 0;
+    }
+    return length + CRYPTO_SEAL_OVERHEAD;
+}
+
+size_t crypto_open(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t *aad, size_t aad_length,
+                   const uint8_t *sealed, size_t sealed_length, uint8_t *out,
+                   uint64_t *nonce_counter, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (sealed_length < CRYPTO_SEAL_OVERHEAD) {
+        set_error(error_flag);
+        return 0;
+    }
+
+    size_t length = sealed_length - CRYPTO_SEAL_OVERHEAD;
+    const uint8_t *nonce = sealed;
+    const uint8_t *ciphertext = sealed + CRYPTO_NONCE_SIZE;
+    uint8_t tag[CRYPTO_TAG_SIZE];
+    memcpy(tag, ciphertext + length, CRYPTO_TAG_SIZE);
+
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    int chunk = 0;
+    int ok = context
+        && EVP_DecryptInit_ex(context, EVP_chacha20_poly1305(), NULL, key, nonce) == 1
+        && (aad_length == 0 || EVP_DecryptUpdate(context, NULL, &chunk, aad, (int) aad_length) == 1)
+        && (length == 0 || EVP_DecryptUpdate(context, out, &chunk, ciphertext, (int) length) == 1)
+        && EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_AEAD_SET_TAG, CRYPTO_TAG_SIZE, tag) == 1
+        && EVP_DecryptFinal_ex(context, out + length, &chunk) == 1;
+
+    EVP_CIPHER_CTX_free(context);
+    if (!ok) {
+        set_error(error_flag);
+        return 0;
+    }
+
+    if (nonce_counter) {
+        *nonce_counter = parse_nonce(nonce);
+    }
+    return length;
+}
@@ -0,0 +1,200 @@
+#include "utils/lz.h"
+
+#include <pthread.h>
+#include <string.h>
+
+enum {
+    LZ_HASH_BITS = 12,
+    LZ_NIBBLE_MAX = 15
+};
+
+// shared by compressor and decompressor, changing it breaks the wire format;
+// the most frequent strings sit at the end, closest to the input
+static const char lz_dictionary[] =
+    "http://https://www.com/index.html.org/.net/ would could should because about which there their "
+    "other after first people think know just like time year good some them than then also into "
+    "only come over work well back even want give most what when where with from this that have "
+    "will your for not are but all any can had her was one our out day get has him his how man new "
+    "now old see two way who boy did its let put say she too use thanks please sorry hello hi yes no ok "
+    "file message server client connected disconnected error failed sent received download upload "
+    "[SERVER]: [127.0.0.1:192.168.10.0.0.1]: the and you that is in it to of a ";
+
+enum {
+    LZ_DICTIONARY_SIZE = sizeof(lz_dictionary) - 1
+};
+
+// hash table holding every dictionary position, the starting point of each compression
+static uint32_t lz_dictionary_table[1 << LZ_HASH_BITS];
+static pthread_once_t lz_dictionary_once = PTHREAD_ONCE_INIT;
+
+// byte at a position of the dictionary followed by the input
+static uint8_t lz_at(const uint8_t *in, size_t position) {
+    return position < LZ_DICTIONARY_SIZE ? (uint8_t) lz_dictionary[position] : in[position - LZ_DICTIONARY_SIZE];
+}
+
+static uint32_t lz_hash(const uint8_t *in, size_t position) {
+    uint32_t value = (uint32_t) lz_at(in, position)
+                     | (uint32_t) lz_at(in, position + 1) << 8
+                     | (uint32_t) lz_at(in, position + 2) << 16
+                     | (uint32_t) lz_at(in, position + 3) << 24;
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void lz_index_dictionary(void) {
+    for (size_t position = 0; position + LZ_MIN_MATCH <= LZ_DICTIONARY_SIZE; ++position) {
+        lz_dictionary_table[lz_hash(NULL, position)] = (uint32_t) position + 1;
+    }
+}
+
+static size_t lz_write_length(uint8_t *out, size_t capacity, size_t written, size_t rest) {
+    while (rest >= 255) {
+        if (written >= capacity) {
+            return 0;
+        }
+        out[written++] = 255;
+        rest -= 255;
+    }
+    if (written >= capacity) {
+        return 0;
+    }
+    out[written++] = (uint8_t) rest;
+    return written;
+}
+
+// appends one sequence, match_length 0 marks the last one; returns the new size or 0 when out is full
+static size_t lz_write_sequence(uint8_t *out, size_t capacity, size_t written, const uint8_t *literals,
+                                size_t literal_length, size_t offset, size_t match_length) {
+    size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    if (written >= capacity) {
+        return 0;
+    }
+    out[written++] = (uint8_t) ((literal_length < LZ_NIBBLE_MAX ? literal_length : LZ_NIBBLE_MAX) << 4
+                                | (match_code < LZ_NIBBLE_MAX ? match_code : LZ_NIBBLE_MAX));
+
+    if (literal_length >= LZ_NIBBLE_MAX
+        && !(written = lz_write_length(out, capacity, written, literal_length - LZ_NIBBLE_MAX))) {
+        return 0;
+    }
+    if (literal_length > capacity - written) {
+        return 0;
+    }
+    memcpy(out + written, literals, literal_length);
+    written += literal_length;
+
+    if (match_length == 0) {
+        return written;
+    }
+    if (capacity - written < 2) {
+        return 0;
+    }
+    out[written++] = (uint8_t) (offset & 0xff);
+    out[written++] = (uint8_t) (offset >> 8);
+    if (match_code >= LZ_NIBBLE_MAX) {
+        return lz_write_length(out, capacity, written, match_code - LZ_NIBBLE_MAX);
+    }
+    return written;
+}
+
+size_t lz_compress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity) {
+    uint32_t table[1 << LZ_HASH_BITS]; // position + 1 of the latest 4 bytes with that hash
+    size_t end = LZ_DICTIONARY_SIZE + length;
+
+    pthread_once(&lz_dictionary_once, lz_index_dictionary);
+    memcpy(table, lz_dictionary_table, sizeof(table));
+
+    size_t written = 0;
+    size_t anchor = LZ_DICTIONARY_SIZE;
+    size_t position = LZ_DICTIONARY_SIZE;
+    while (position + LZ_MIN_MATCH <= end) {
+        uint32_t hash = lz_hash(in, position);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t) position + 1;
+
+        size_t match_length = 0;
+        if (candidate > 0 && position - (candidate - 1) <= LZ_MAX_OFFSET) {
+            --candidate;
+            while (position + match_length < end && lz_at(in, candidate + match_length) == lz_at(in, position + match_length)) {
+                ++match_length;
+            }
+        }
+        if (match_length < LZ_MIN_MATCH) {
+            ++position;
+            continue;
+        }
+
+        written = lz_write_sequence(out, capacity, written, in + (anchor - LZ_DICTIONARY_SIZE), position - anchor,
+                                    position - candidate, match_length);
+        if (written == 0) {
+            return 0;
+        }
+        for (size_t covered = position + 1; covered < position + match_length && covered + LZ_MIN_MATCH <= end; ++covered) {
+            table[lz_hash(in, covered)] = (uint32_t) covered + 1;
+        }
+        position += match_length;
+        anchor = position;
+    }
+
+    return lz_write_sequence(out, capacity, written, in + (anchor - LZ_DICTIONARY_SIZE), end - anchor, 0, 0);
+}
+
+static int lz_read_length(const uint8_t *in, size_t length, size_t *position, size_t *value) {
+    uint8_t byte;
+    do {
+        if (*position >= length) {
+            return -1;
+        }
+        byte = in[(*position)++];
+        *value += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+size_t lz_decompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    size_t position = 0;
+    size_t produced = 0;
+    while (position < length) {
+        uint8_t token = in[position++];
+        size_t literal_length = token >> 4;
+        if (literal_length == LZ_NIBBLE_MAX && lz_read_length(in, length, &position, &literal_length) < 0) {
+            break;
+        }
+        if (literal_length > length - position || literal_length > capacity - produced) {
+            break;
+        }
+        memcpy(out + produced, in + position, literal_length);
+        position += literal_length;
+        produced += literal_length;
+        if (position == length) {
+            return produced; // last sequence
+        }
+
+        if (length - position < 2) {
+            break;
+        }
+        size_t offset = (size_t) in[position] | (size_t) in[position + 1] << 8;
+        position += 2;
+        size_t match_length = token & LZ_NIBBLE_MAX;
+        if (match_length == LZ_NIBBLE_MAX && lz_read_length(in, length, &position, &match_length) < 0) {
+            break;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > produced + LZ_DICTIONARY_SIZE || match_length > capacity - produced) {
+            break;
+        }
+
+        // byte by byte: the source may overlap what is being written
+        for (size_t i = 0; i < match_length; ++i, ++produced) {
+            out[produced] = offset > produced ? (uint8_t) lz_dictionary[LZ_DICTIONARY_SIZE - (offset - produced)]
+                                              : out[produced - offset];
+        }
+    }
+
+    if (error_flag) {
+        *error_flag = 1;
+    }
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "utils/parse.h"
 
+#include <math.h>
 #include <stdlib.h>
 
 int parse_port(const char *arg, int *error_flag) {
@@ -33,3 +34,54 @@ int parse_port(const char *arg, int *error_flag) {
 
     return (int) port;
 }
+
+size_t parse_size(const char *arg, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!arg || *arg == '-') {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    char *end = NULL;
+    unsigned long long size = strtoull(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0') {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    return (size_t) size;
+}
+
+// non-negative finite decimal
+double parse_double(const char *arg, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    if (!arg) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    char *end = NULL;
+    double value = strtod(arg, &end);
+
+    if (*arg == '\0' || *end != '\0' || !isfinite(value) || value < 0) {
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return 0;
+    }
+
+    return value;
+}
@@ -1,6 +1,8 @@
 #include "utils/safe_io.h"
 
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 ssize_t safe_read(int file_descriptor, void *buffer, size_t count, int *error_flag) {
@@ -22,6 +24,25 @@ ssize_t safe_read(int file_descriptor, void *buffer, size_t count, int *error_fl
     }
 }
 
+ssize_t safe_recv(int file_descriptor, void *buffer, size_t count, int flags, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    while (1) {
+        ssize_t bytes_read = recv(file_descriptor, buffer, count, flags);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && error_flag) {
+                *error_flag = 1;
+            }
+        }
+        return bytes_read;
+    }
+}
+
 ssize_t safe_write(int file_descriptor, const void *buffer, size_t count, int *error_flag) {
     if (error_flag) {
         *error_flag = 0;
@@ -45,3 +66,36 @@ ssize_t safe_write(int file_descriptor, const void *buffer, size_t count, int *e
     }
     return (ssize_t) written_total;
 }
+
+ssize_t safe_writev(int file_descriptor, struct iovec *iov, int iov_count, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    size_t written_total = 0;
+    while (iov_count > 0) {
+        ssize_t written = writev(file_descriptor, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (error_flag) {
+                *error_flag = 1;
+            }
+            return -1;
+        }
+        written_total += (size_t) written;
+
+        size_t remaining = (size_t) written;
+        while (iov_count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            ++iov;
+            --iov_count;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *) iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+    return (ssize_t) written_total;
+}
@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+
+#include "TestPeer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "utils/clock.h"
+
+struct TestPeer {
+    int file_descriptor;
+    FrameReader *reader;
+};
+
+ProcessingServer *TestPeer_create_server(int *port) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int create_error = 0;
+        int candidate = 20000 + (int) ((getpid() * 7 + attempt * 131) % 40000);
+        ProcessingServer *server = ProcessingServer_create(candidate, &create_error);
+        if (!create_error) {
+            *port = candidate;
+            return server;
+        }
+    }
+    return NULL;
+}
+
+TestPeer *TestPeer_connect(int port, uint64_t epoch, uint64_t last_sequence, int *error_flag) {
+    if (error_flag) {
+        *error_flag = 0;
+    }
+
+    TestPeer *peer = calloc(1, sizeof(TestPeer));
+    int reader_error = 0;
+    if (!peer || !(peer->reader = FrameReader_create(&reader_error)) || reader_error) {
+        free(peer);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t) port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    peer->file_descriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (peer->file_descriptor < 0
+        || connect(peer->file_descriptor, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        TestPeer_destroy(peer);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+
+    uint8_t hello[HELLO_PAYLOAD_SIZE] = {0};
+    hello[0] = PROTOCOL_VERSION;
+    Protocol_write_u64(hello + 1 + CRYPTO_PUBLIC_KEY_SIZE, epoch);
+    Protocol_write_u64(hello + 1 + CRYPTO_PUBLIC_KEY_SIZE + 8, last_sequence);
+    int send_error = 0;
+    TestPeer_send(peer, FRAME_HELLO, hello, sizeof(hello), &send_error);
+    if (send_error) {
+        TestPeer_destroy(peer);
+        if (error_flag) {
+            *error_flag = 1;
+        }
+        return NULL;
+    }
+    return peer;
+}
+
+void TestPeer_destroy(TestPeer *peer) {
+    if (!peer) {
+        return;
+    }
+    if (peer->file_descriptor >= 0) {
+        close(peer->file_descriptor);
+    }
+    FrameReader_destroy(peer->reader);
+    free(peer);
+}
+
+void TestPeer_send(TestPeer *peer, uint8_t type, const void *payload, size_t length, int *error_flag) {
+    FrameHeader header = {type, 0, (uint32_t) length, 0};
+    Protocol_send_frame(peer->file_descriptor, &header, payload, error_flag);
+}
+
+int TestPeer_next_frame(TestPeer *peer, ProcessingServer *server, int timeout_ms, FrameHeader *header,
+                        const uint8_t **payload) {
+    uint64_t deadline = clock_monotonic_ms() + (uint64_t) timeout_ms;
+    for (;;) {
+        int frame_error = 0;
+        if (FrameReader_next(peer->reader, header, payload, &frame_error)) {
+            return 1;
+        }
+        if (frame_error) {
+            return -1;
+        }
+
+        int poll_error = 0;
+        ProcessingServer_poll_once(server, 1, &poll_error);
+        int fill_error = 0;
+        ssize_t received = FrameReader_fill(peer->reader, peer->file_descriptor, MSG_DONTWAIT, &fill_error);
+        if (received == 0 || fill_error) {
+            return -1;
+        }
+        if (received < 0 && clock_monotonic_ms() >= deadline) {
+            return 0;
+        }
+    }
+}
+
+void TestPeer_pump(TestPeer *peer, ProcessingServer *server, int duration_ms) {
+    uint64_t deadline = clock_monotonic_ms() + (uint64_t) duration_ms;
+    FrameHeader header;
+    const uint8_t *payload;
+    while (clock_monotonic_ms() < deadline && TestPeer_next_frame(peer, server, 1, &header, &payload) >= 0) {
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "core/ProcessingServer.h"
+#include "core/Protocol.h"
+
+// a relay on a free local port, NULL if none could be bound
+ProcessingServer *TestPeer_create_server(int *port);
+
+// raw protocol connection to a relay that runs on the calling thread: waiting for a
+// frame keeps polling the relay, so one thread drives both ends
+typedef struct TestPeer TestPeer;
+
+// connects and sends a plain HELLO resuming after last_sequence of epoch (0 for a new client)
+TestPeer *TestPeer_connect(int port, uint64_t epoch, uint64_t last_sequence, int *error_flag);
+void TestPeer_destroy(TestPeer *peer);
+
+void TestPeer_send(TestPeer *peer, uint8_t type, const void *payload, size_t length, int *error_flag);
+
+// polls the relay until a frame arrives; returns 1 with the frame (payload valid until
+// the next call), 0 after timeout_ms, -1 once the relay closed the connection
+int TestPeer_next_frame(TestPeer *peer, ProcessingServer *server, int timeout_ms, FrameHeader *header,
+                        const uint8_t **payload);
+
+// polls the relay for duration_ms, reading whatever arrives for the peer
+void TestPeer_pump(TestPeer *peer, ProcessingServer *server, int duration_ms);
+
+#define TEST_CHECK(condition)                                                             \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            return 1;                                                                     \
+        }                                                                                 \
+    } while (0)
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TestPeer.h"
+#include "utils/clock.h"
+
+enum {
+    TEST_SKIPPED = 77, // ctest SKIP_RETURN_CODE
+    RING_CAPACITY = 2048,
+    RESUME_RETAIN = 1024, // what the relay keeps once every subscriber acknowledged
+};
+
+typedef struct {
+    int connects;
+} ConnectCounter;
+
+void test_count_connect(void *context, uint32_t connection_id, const struct sockaddr_in *address) {
+    (void) connection_id;
+    (void) address;
+    ++((ConnectCounter *) context)->connects;
+}
+
+void test_poll(ProcessingServer *server, int duration_ms) {
+    uint64_t deadline = clock_monotonic_ms() + (uint64_t) duration_ms;
+    while (clock_monotonic_ms() < deadline) {
+        int poll_error = 0;
+        ProcessingServer_poll_once(server, 10, &poll_error);
+    }
+}
+
+void test_publish_burst(ProcessingServer *server, int count) {
+    char text[1000];
+    memset(text, 'x', sizeof(text));
+    for (int i = 0; i < count; ++i) {
+        int publish_error = 0;
+        ProcessingServer_publish(server, text, sizeof(text), &publish_error);
+    }
+}
+
+// run_Client on the relay's port, its input held open by the returned pipe end
+pid_t test_spawn_client(const char *client_path, int port, int *input) {
+    int pipe_ends[2];
+    if (pipe(pipe_ends) < 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        char port_text[16];
+        snprintf(port_text, sizeof(port_text), "%d", port);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(pipe_ends[0], STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execl(client_path, client_path, "--multicast", "127.0.0.1", port_text, (char *) NULL);
+        _exit(127);
+    }
+    close(pipe_ends[0]);
+    *input = pipe_ends[1];
+    return pid;
+}
+
+// a multicast subscriber that misses more than the ring holds gives the gap up, caps its
+// acknowledgements before it and resumes; the resume must release the ring again, or
+// every later broadcast would evict one the relay still counts as unacknowledged
+int test_ring_bounded_after_skipped_gap(const char *client_path) {
+    int port = 0;
+    ProcessingServer *server = TestPeer_create_server(&port);
+    TEST_CHECK(server);
+
+    int setup_error = 0;
+    ProcessingServer_enable_reliable_delivery(server, RING_CAPACITY, &setup_error);
+    TEST_CHECK(!setup_error);
+    char group_ip[INET_ADDRSTRLEN];
+    snprintf(group_ip, sizeof(group_ip), "239.255.%d.%d", (int) (getpid() >> 8) & 255, (int) getpid() & 255);
+    ProcessingServer_enable_multicast(server, group_ip, port + 1, "127.0.0.1", &setup_error);
+    if (setup_error) {
+        ProcessingServer_destroy(server);
+        return TEST_SKIPPED;
+    }
+
+    ConnectCounter counter = {0};
+    ProcessingServerCallbacks callbacks = {test_count_connect, NULL, NULL, &counter};
+    ProcessingServer_set_callbacks(server, &callbacks);
+
+    int input = -1;
+    pid_t client = test_spawn_client(client_path, port, &input);
+    TEST_CHECK(client > 0);
+    for (int waited = 0; counter.connects == 0 && waited < 3000; waited += 100) {
+        test_poll(server, 100);
+    }
+    test_poll(server, 500); // lets the SUBSCRIBE arrive
+
+    // stopped, the client's socket buffer overflows and the ring evicts what it missed
+    kill(client, SIGSTOP);
+    test_publish_burst(server, 3 * RING_CAPACITY);
+    kill(client, SIGCONT);
+
+    ProcessingServerStats stats;
+    uint64_t deadline = clock_monotonic_ms() + 10000;
+    do {
+        test_poll(server, 100);
+        ProcessingServer_get_stats(server, &stats);
+    } while (stats.retained_messages > RESUME_RETAIN && clock_monotonic_ms() < deadline);
+    uint64_t lost_before = stats.unacked_lost;
+    int connects_before = counter.connects;
+
+    for (int batch = 0; batch < 20; ++batch) {
+        test_publish_burst(server, 100);
+        test_poll(server, 20);
+    }
+    test_poll(server, 1000);
+    ProcessingServer_get_stats(server, &stats);
+
+    kill(client, SIGTERM);
+    close(input);
+    waitpid(client, NULL, 0);
+    ProcessingServer_destroy(server);
+
+    if (counter.connects == 0) {
+        return TEST_SKIPPED; // the client could not start
+    }
+    TEST_CHECK(stats.nack_requests > 0);
+    TEST_CHECK(stats.retained_messages <= RESUME_RETAIN);
+    TEST_CHECK(stats.unacked_lost == lost_before);
+    TEST_CHECK(connects_before > 1);
+    TEST_CHECK(stats.lingering_subscribers == 0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <run_Client>\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int result = test_ring_bounded_after_skipped_gap(argv[1]);
+    printf("%s %s\n", result == TEST_SKIPPED ? "skip" : result ? "FAIL" : "ok  ", "ring_bounded_after_skipped_gap");
+    return result;
+}
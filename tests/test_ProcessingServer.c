@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "TestPeer.h"
+
+enum {
+    SNAPSHOT_KEYS = 200,
+    SNAPSHOT_VALUE_SIZE = 60000 // 200 of them are well past a client's 8 MiB outbound queue
+};
+
+// a last-value cache larger than the outbound queue still reaches a new client, in full
+int test_snapshot_larger_than_queue(void) {
+    int port = 0;
+    ProcessingServer *server = TestPeer_create_server(&port);
+    TEST_CHECK(server);
+
+    static uint8_t value[SNAPSHOT_VALUE_SIZE];
+    for (int key = 0; key < SNAPSHOT_KEYS; ++key) {
+        char name[16];
+        int name_length = snprintf(name, sizeof(name), "key%d", key);
+        memset(value, 'a' + key % 26, sizeof(value));
+        int publish_error = 0;
+        ProcessingServer_publish_update(server, name, (size_t) name_length, value, sizeof(value), &publish_error);
+        TEST_CHECK(!publish_error);
+    }
+
+    int connect_error = 0;
+    TestPeer *peer = TestPeer_connect(port, 0, 0, &connect_error);
+    TEST_CHECK(peer);
+
+    FrameHeader header;
+    const uint8_t *payload;
+    TEST_CHECK(TestPeer_next_frame(peer, server, 2000, &header, &payload) == 1);
+    TEST_CHECK(header.type == FRAME_WELCOME);
+
+    int updates = 0;
+    int is_live_sent = 0;
+    int is_live_seen = 0;
+    while (updates < SNAPSHOT_KEYS + 1 && TestPeer_next_frame(peer, server, 2000, &header, &payload) == 1) {
+        if (header.type != FRAME_UPDATE) {
+            continue;
+        }
+        ++updates;
+        is_live_seen |= header.length == 1 + 4 + 4 && memcmp(payload + 1, "key0live", 8) == 0;
+        if (!is_live_sent) {
+            // a key the snapshot already passed, it has to arrive live
+            int publish_error = 0;
+            ProcessingServer_publish_update(server, "key0", 4, "live", 4, &publish_error);
+            is_live_sent = !publish_error;
+        }
+    }
+    TEST_CHECK(updates == SNAPSHOT_KEYS + 1);
+    TEST_CHECK(is_live_seen);
+
+    TestPeer_destroy(peer);
+    ProcessingServer_destroy(server);
+    return 0;
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        int (*run)(void);
+    } tests[] = {
+        {"snapshot_larger_than_queue", test_snapshot_larger_than_queue},
+    };
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        int result = tests[i].run();
+        printf("%s %s\n", result ? "FAIL" : "ok  ", tests[i].name);
+        failed += result != 0;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "TestPeer.h"
+#include "core/Replay.h"
+#include "core/Trace.h"
+
+typedef struct {
+    ProcessingServer *server;
+    volatile int is_stopping;
+} RelayThread;
+
+void *test_run_relay(void *context) {
+    RelayThread *relay = context;
+    while (!relay->is_stopping) {
+        int poll_error = 0;
+        ProcessingServer_poll_once(relay->server, 10, &poll_error);
+    }
+    return NULL;
+}
+
+void test_write_frame(TraceWriter *writer, uint64_t timestamp_ns, uint8_t type, const void *payload, uint32_t length,
+                      int *error_flag) {
+    TraceRecord record = {timestamp_ns, 1, TRACE_FRAME, type, length};
+    TraceWriter_write(writer, &record, payload, error_flag);
+}
+
+// recorded SUBSCRIBE, NACK and ACK frames are not resent: the replayed connection never
+// joined a group, and its acknowledgements would release ring slots it was never sent
+int test_control_frames_not_replayed(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "test_Replay_%d.trace", (int) getpid());
+
+    int write_error = 0;
+    TraceWriter *writer = TraceWriter_create(path, &write_error);
+    TEST_CHECK(writer);
+    uint8_t ack[ACK_PAYLOAD_SIZE];
+    Protocol_write_u64(ack, 1000);
+    uint8_t nack[NACK_PAYLOAD_SIZE];
+    Protocol_write_u64(nack, 1);
+    Protocol_write_u32(nack + 8, 5);
+    TraceRecord connect_record = {0, 1, TRACE_CONNECT, 0, 0};
+    TraceWriter_write(writer, &connect_record, NULL, &write_error);
+    // keyed updates are unsequenced, so the replayed connection has nothing of its own to acknowledge
+    test_write_frame(writer, 1000, FRAME_UPDATE, "\001kfirst", 7, &write_error);
+    test_write_frame(writer, 2000, FRAME_SUBSCRIBE, "", 0, &write_error);
+    test_write_frame(writer, 3000, FRAME_ACK, ack, sizeof(ack), &write_error);
+    test_write_frame(writer, 4000, FRAME_NACK, nack, sizeof(nack), &write_error);
+    test_write_frame(writer, 5000, FRAME_UPDATE, "\001klast", 6, &write_error);
+    TraceRecord disconnect_record = {6000, 1, TRACE_DISCONNECT, 0, 0};
+    TraceWriter_write(writer, &disconnect_record, NULL, &write_error);
+    TraceWriter_destroy(writer);
+    TEST_CHECK(!write_error);
+
+    int port = 0;
+    RelayThread relay = {TestPeer_create_server(&port), 0};
+    TEST_CHECK(relay.server);
+    int setup_error = 0;
+    ProcessingServer_enable_reliable_delivery(relay.server, 4096, &setup_error);
+    TEST_CHECK(!setup_error);
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, NULL, test_run_relay, &relay) == 0);
+
+    int replay_error = 0;
+    Replay *replay = Replay_create(path, "127.0.0.1", port, &replay_error);
+    if (replay) {
+        Replay_set_speed(replay, 0);
+        Replay_run(replay, &replay_error);
+    }
+    ReplayReport report = {0};
+    Replay_get_report(replay, &report);
+    Replay_destroy(replay);
+
+    relay.is_stopping = 1;
+    pthread_join(thread, NULL);
+    ProcessingServerStats stats;
+    ProcessingServer_get_stats(relay.server, &stats);
+    ProcessingServer_destroy(relay.server);
+    unlink(path);
+
+    TEST_CHECK(!replay_error);
+    TEST_CHECK(report.frames_sent == 2);
+    TEST_CHECK(report.frames_ignored == 3);
+    TEST_CHECK(stats.acks_received == 0);
+    TEST_CHECK(stats.nack_requests == 0);
+    TEST_CHECK(stats.updates_published == 2);
+    return 0;
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        int (*run)(void);
+    } tests[] = {
+        {"control_frames_not_replayed", test_control_frames_not_replayed},
+    };
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        int result = tests[i].run();
+        printf("%s %s\n", result ? "FAIL" : "ok  ", tests[i].name);
+        failed += result != 0;
+    }
+    return failed ? 1 : 0;
+}